@@ -7,295 +7,1713 @@
 /// @studid <2019-19932>
 //--------------------------------------------------------------------------------------------------
 
-#define _GNU_SOURCE
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdbool.h>
-#include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <dirent.h>
-#include <errno.h>
-#include <unistd.h>
-#include <stdarg.h>
-#include <assert.h>
-#include <grp.h>
-#include <pwd.h>
-
-#define MAX_DIR 64            ///< maximum number of supported directories
-
-/// @brief output control flags
-#define F_TREE      0x1       ///< enable tree view
-#define F_SUMMARY   0x2       ///< enable summary
-#define F_VERBOSE   0x4       ///< turn on verbose mode
-
-/// @brief struct holding the summary
-struct summary {
-  unsigned int dirs;          ///< number of directories encountered
-  unsigned int files;         ///< number of files
-  unsigned int links;         ///< number of links
-  unsigned int fifos;         ///< number of pipes
-  unsigned int socks;         ///< number of sockets
-
-  unsigned long long size;    ///< total size (in bytes)
-  unsigned long long blocks;  ///< total number of blocks (512 byte blocks)
+#include "dirtree.h"
+#include <pthread.h>
+#include <sys/resource.h>
+
+/// @brief slot of an id cache
+struct idname {
+  unsigned int id;            ///< user or group id
+  char *name;                 ///< name of the id; NULL if the slot is empty
+};
+
+/// @brief open-addressing hash table caching the names of user or group ids
+struct idcache {
+  struct idname *tab;         ///< slots (linear probing)
+  size_t cap;                 ///< number of slots (power of two)
+  size_t num;                 ///< number of used slots
+  bool   group;               ///< true: group ids, false: user ids
+};
+
+/// @brief slot of the inode set
+struct inodekey {
+  uint64_t ino;               ///< inode number; 0 if the slot is empty
+  uint64_t dev;               ///< device
+};
+
+/// @brief open-addressing hash set of the multi-link inodes seen (--count-links=once). Only
+///        inodes with more than one link are inserted, so its size follows the number of hard
+///        links in the tree, not the number of files. Shared by the -j workers.
+struct inodeset {
+  struct inodekey *tab;       ///< slots (linear probing)
+  size_t cap;                 ///< number of slots (power of two)
+  size_t num;                 ///< number of used slots
+  pthread_mutex_t lock;       ///< serializes lookups of the -j workers
 };
 
+/// @brief totals of the entries on one device (--dev-summary)
+struct devstat {
+  uint32_t dev;               ///< device, major << 20 | minor
+  struct summary sum;         ///< totals of the entries on the device
+};
+
+/// @brief devices seen below the current path (--dev-summary). A tree spans few devices, so
+///        the table is searched linearly, starting with the device of the previous entry.
+struct devtable {
+  struct devstat *tab;        ///< devices in the order they were seen
+  size_t num;                 ///< number of devices
+  size_t cap;                 ///< capacity of tab
+  size_t last;                ///< index of the device of the previous entry
+};
+
+/// @brief sort record of a directory entry. The key orders entries like dirent_compare() as far
+///        as it goes, so most comparisons are a single integer compare.
+struct sortrec {
+  uint64_t key;               ///< bit 63: not a directory; bits 62..0: first 8 name bytes (big-endian) >> 1
+  uint32_t name;              ///< offset of the name in the name buffer (for ties)
+  uint32_t idx;               ///< index of the entry in the listing
+};
+
+/// @brief output buffer. Everything printed to stdout goes through this buffer and is written with
+///        a single write() per flush.
+struct outbuf {
+  char   buf[256*1024];       ///< buffered output
+  size_t len;                 ///< number of buffered bytes
+  int    fd;                  ///< output file descriptor
+  struct membuf *mem;         ///< if set, output is appended here instead of written to fd
+};
+
+/// @brief path of the directory being walked, built up for --du only (the tree output never
+///        needs full paths)
+struct pathbuf {
+  char   *buf;                ///< path; not null-terminated
+  size_t len;                 ///< length of the path
+  size_t cap;                 ///< capacity of buf
+};
+
+__thread struct counters counters;      ///< performance counters of the calling thread
+static struct outbuf out = { .fd = STDOUT_FILENO }; ///< stdout buffer
+size_t getdents_bufsize = 32768;        ///< size of the getdents64 buffer (--getdents-buf)
+unsigned int sort_algo = SORT_AUTO;     ///< sort algorithm (--sort-algo)
+size_t mem_limit = 0;                   ///< memory budget of a directory listing (--mem-limit)
+unsigned int max_depth = UINT_MAX;      ///< deepest level printed (-L/--max-depth); the root is level 0
+__thread struct arena ent_arena;        ///< arena for entry arrays
+__thread struct arena str_arena;        ///< arena for names
+static __thread char *dbuf;             ///< getdents64 buffer
+static struct idcache users = { .group = false };  ///< user name cache
+static struct idcache groups = { .group = true };  ///< group name cache
+static struct pathbuf du_path;          ///< --du: path of the current directory
+static struct inodeset inodes = { .lock = PTHREAD_MUTEX_INITIALIZER }; ///< --count-links=once
+static struct devtable devices;         ///< --dev-summary: totals per device of the current path
+
+
+/// @brief write all buffered output to the output file descriptor
+void out_flush(void)
+{
+  size_t pos = 0;
+
+  if (out.mem) {
+    struct membuf *m = out.mem;
+    if (m->len + out.len > m->cap) {
+      m->cap = (m->cap ? 2*m->cap : sizeof(out.buf)) + out.len;
+      m->buf = (char*)xrealloc(m->buf, m->cap);
+    }
+    memcpy(m->buf + m->len, out.buf, out.len);
+    m->len += out.len;
+    out.len = 0;
+    return;
+  }
+
+  while (pos < out.len) {
+    ssize_t n = write(out.fd, out.buf + pos, out.len - pos);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      // nothing sensible can be printed if stdout is gone
+      exit(EXIT_FAILURE);
+    }
+    pos += n;
+  }
+  out.len = 0;
+}
+
+/// @brief flush the output buffer and append further output to @a m instead of writing it
+///
+/// @param m memory buffer or NULL to write to the output file descriptor again
+/// @retval previous memory buffer or NULL
+struct membuf *out_capture(struct membuf *m)
+{
+  struct membuf *old = out.mem;
+
+  out_flush();
+  out.mem = m;
+  return old;
+}
 
 /// @brief abort the program with EXIT_FAILURE and an optional error message
 ///
 /// @param msg optional error message or NULL
 void panic(const char *msg)
 {
+  out_flush();
   if (msg) fprintf(stderr, "%s\n", msg);
   exit(EXIT_FAILURE);
 }
 
-/// @brief read next directory entry from open directory 'dir'. Ignores '.' and '..' entries
+/// @brief append @a len bytes to the output buffer
+///
+/// @param str data
+/// @param len number of bytes
+void out_write(const char *str, size_t len)
+{
+  if (out.len + len > sizeof(out.buf)) {
+    out_flush();
+    if (len > sizeof(out.buf)) {
+      // too large to buffer; write the data through
+      out.len = 0;
+      while (len > 0) {
+        size_t n = len < sizeof(out.buf) ? len : sizeof(out.buf);
+        memcpy(out.buf, str, n);
+        out.len = n;
+        out_flush();
+        str += n;
+        len -= n;
+      }
+      return;
+    }
+  }
+  memcpy(out.buf + out.len, str, len);
+  out.len += len;
+}
+
+/// @brief append a string to the output buffer
+///
+/// @param str null-terminated string
+void out_puts(const char *str)
+{
+  out_write(str, strlen(str));
+}
+
+/// @brief append a character to the output buffer
 ///
-/// @param dir open DIR* stream
-/// @retval entry on success
-/// @retval NULL on error or if there are no more entries
-struct dirent *getNext(DIR *dir)
+/// @param c character
+void out_putc(char c)
 {
-  struct dirent *next;
+  if (out.len == sizeof(out.buf)) out_flush();
+  out.buf[out.len++] = c;
+}
+
+/// @brief append @a n copies of character @a c to the output buffer
+///
+/// @param c character
+/// @param n number of characters
+void out_fill(char c, size_t n)
+{
+  while (n > 0) {
+    if (out.len == sizeof(out.buf)) out_flush();
+    size_t m = sizeof(out.buf) - out.len;
+    if (m > n) m = n;
+    memset(out.buf + out.len, c, m);
+    out.len += m;
+    n -= m;
+  }
+}
+
+/// @brief append a string right-aligned in a field of @a width characters (printf "%*s")
+///
+/// @param str null-terminated string
+/// @param width field width. Longer strings are not cut.
+void out_str_right(const char *str, size_t width)
+{
+  size_t len = strlen(str);
+  if (len < width) out_fill(' ', width - len);
+  out_write(str, len);
+}
+
+/// @brief append a string left-aligned in a field of @a width characters (printf "%-*s")
+///
+/// @param str null-terminated string
+/// @param width field width. Longer strings are not cut.
+void out_str_left(const char *str, size_t width)
+{
+  size_t len = strlen(str);
+  out_write(str, len);
+  if (len < width) out_fill(' ', width - len);
+}
+
+/// @brief append a signed integer right-aligned in a field of @a width characters (printf "%*lld")
+///
+/// @param val value
+/// @param width field width. Longer numbers are not cut.
+void out_num(long long val, size_t width)
+{
+  char digits[24];
+  char *p = digits + sizeof(digits);
+  unsigned long long u = val < 0 ? -(unsigned long long)val : (unsigned long long)val;
+
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u > 0);
+  if (val < 0) *--p = '-';
+
+  size_t len = digits + sizeof(digits) - p;
+  if (len < width) out_fill(' ', width - len);
+  out_write(p, len);
+}
+
+/// @brief append formatted output to the output buffer. For headers and summaries; the per-entry
+///        output uses the specialized out_* functions.
+///
+/// @param fmt printf format string
+/// @param ... parameters
+void out_printf(const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(out.buf + out.len, sizeof(out.buf) - out.len, fmt, ap);
+  va_end(ap);
+  if (n < 0) panic("Output error.");
+
+  if ((size_t)n >= sizeof(out.buf) - out.len) {
+    out_flush();
+    va_start(ap, fmt);
+    n = vsnprintf(out.buf, sizeof(out.buf), fmt, ap);
+    va_end(ap);
+    if ((n < 0) || ((size_t)n >= sizeof(out.buf))) panic("Output error.");
+  }
+  out.len += n;
+}
+
+/// @brief allocate memory. Aborts the program if out of memory.
+///
+/// @param size number of bytes
+/// @retval pointer to the allocated memory
+void *xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if (p == NULL) panic("Out of memory.");
+  counters.allocs++;
+  return p;
+}
+
+/// @brief resize an allocation. Aborts the program if out of memory.
+///
+/// @param ptr allocation to resize or NULL
+/// @param size new size in bytes
+/// @retval pointer to the (possibly moved) allocation
+void *xrealloc(void *ptr, size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (p == NULL) panic("Out of memory.");
+  counters.allocs++;
+  return p;
+}
+
+/// @brief allocate @a size bytes from arena @a a
+///
+/// @param a arena
+/// @param size number of bytes
+/// @retval pointer to the allocated memory (aligned to ARENA_ALIGN)
+void *arena_alloc(struct arena *a, size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if ((a->cur == NULL) || (a->cur->size - a->top < size)) {
+    // move on to the next retained chunk if it is large enough, otherwise insert a new chunk
+    struct arena_chunk *next = a->cur ? a->cur->next : a->first;
+
+    if ((next == NULL) || (next->size < size)) {
+      size_t csize = a->cur ? 2*a->cur->size : ARENA_CHUNK;
+      if (csize < size) csize = size;
+
+      struct arena_chunk *c = (struct arena_chunk*)xmalloc(sizeof(struct arena_chunk) + csize);
+      c->size = csize;
+      c->next = next;
+      if (a->cur) a->cur->next = c;
+      else a->first = c;
+      next = c;
+    }
+    a->cur = next;
+    a->top = 0;
+  }
+
+  void *p = a->cur->data + a->top;
+  a->top += size;
+  return p;
+}
+
+/// @brief grow the allocation @a p of arena @a a from @a old to @a size bytes. The most recent
+///        allocation is extended in place if possible; otherwise the data is moved.
+///
+/// @param a arena
+/// @param p allocation to grow or NULL
+/// @param old current size of @a p
+/// @param size new size
+/// @retval pointer to the (possibly moved) allocation
+void *arena_grow(struct arena *a, void *p, size_t old, size_t size)
+{
+  if (p && ((char*)p + ((old + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1)) == a->cur->data + a->top)) {
+    size_t start = (char*)p - a->cur->data;
+    if (a->cur->size - start >= size) {
+      a->top = start;
+      return arena_alloc(a, size);
+    }
+  }
+
+  void *q = arena_alloc(a, size);
+  if (p) memcpy(q, p, old);
+  return q;
+}
+
+/// @brief get the current state of arena @a a
+///
+/// @param a arena
+/// @retval mark to pass to arena_release()
+struct arena_mark arena_mark(struct arena *a)
+{
+  return (struct arena_mark){ .chunk = a->cur, .top = a->top };
+}
+
+/// @brief release all allocations made from arena @a a since mark @a m was taken
+///
+/// @param a arena
+/// @param m mark
+void arena_release(struct arena *a, struct arena_mark m)
+{
+  a->cur = m.chunk;
+  a->top = m.top;
+}
+
+/// @brief read next directory entry from directory reader @a rd. Ignores '.' and '..' entries
+///
+/// @param rd directory reader
+/// @retval entry on success. The entry points into the reader's buffer and is valid until the
+///         next call to getNext()
+/// @retval NULL on error (errno stored in rd->err) or if there are no more entries
+struct linux_dirent64 *getNext(struct dirreader *rd)
+{
+  struct linux_dirent64 *next;
   int ignore;
 
   do {
-    errno = 0;
-    next = readdir(dir);
-    if (errno != 0) perror(NULL);
-    ignore = next && ((strcmp(next->d_name, ".") == 0) || (strcmp(next->d_name, "..") == 0));
-  } while (next && ignore);
+    if (rd->pos >= rd->end) {
+      long n = syscall(SYS_getdents64, rd->fd, rd->buf, rd->size);
+      counters.getdents++;
+      if (n < 0) rd->err = errno;
+      if (n <= 0) return NULL;
+      rd->pos = 0;
+      rd->end = n;
+    }
+
+    next = (struct linux_dirent64*)(rd->buf + rd->pos);
+    rd->pos += next->d_reclen;
 
+    // "." and ".." are the only names that start with a dot and are at most two characters long
+    ignore = (next->d_name[0] == '.') &&
+             ((next->d_name[1] == '\0') || ((next->d_name[1] == '.') && (next->d_name[2] == '\0')));
+  } while (ignore);
+
+  counters.entries++;
   return next;
 }
 
 
-/// @brief qsort comparator to sort directory entries. Sorted by name, directories first.
+/// @brief append an entry to a listing. The entries and names are allocated from ent_arena and
+///        str_arena, respectively; nothing else may be allocated from them while the listing grows.
+///
+/// @param l listing
+/// @param ino inode number
+/// @param type file type (DT_*)
+/// @param name name (need not be null-terminated)
+/// @param len length of the name
+void listing_push(struct listing *l, uint64_t ino, unsigned char type, const char *name, size_t len)
+{
+  if (l->num == l->cap) {
+    size_t cap = l->cap ? 2*l->cap : 64;
+    l->ents = (struct entry*)arena_grow(&ent_arena, l->ents, l->cap * sizeof(struct entry),
+                                        cap * sizeof(struct entry));
+    l->cap = cap;
+  }
+  if (l->nlen + len + 1 > l->ncap) {
+    size_t ncap = l->ncap ? 2*l->ncap : 1024;
+    if (ncap < l->nlen + len + 1) ncap = l->nlen + len + 1;
+    l->names = (char*)arena_grow(&str_arena, l->names, l->nlen, ncap);
+    l->ncap = ncap;
+  }
+  if (l->nlen + len + 1 > UINT32_MAX) panic("Directory too large.");
+
+  struct entry *e = &l->ents[l->num++];
+  e->ino = ino;
+  e->name = l->nlen;
+  e->namelen = len;
+  e->type = type;
+
+  memcpy(l->names + l->nlen, name, len);
+  l->names[l->nlen + len] = '\0';
+  l->nlen += len + 1;
+}
+
+/// @brief build the sort record of entry @a idx of listing @a l
+///
+/// Names compare like strcmp(), i.e., as unsigned bytes with the terminating null byte smaller
+/// than any character, so the first 8 bytes loaded big-endian and zero-padded compare the same
+/// way. The lowest bit is dropped to make room for the directory flag; the key still never
+/// contradicts the full comparison, it just ties more often.
+///
+/// @param l listing
+/// @param idx index of the entry
+/// @retval sort record
+static inline struct sortrec sortrec_make(const struct listing *l, size_t idx)
+{
+  const struct entry *e = &l->ents[idx];
+  uint64_t prefix = 0;
+
+  memcpy(&prefix, l->names + e->name, e->namelen < 8 ? e->namelen : 8);
+  prefix = be64toh(prefix);
+
+  return (struct sortrec){ .key = ((uint64_t)(e->type != DT_DIR) << 63) | (prefix >> 1),
+                           .name = e->name, .idx = (uint32_t)idx };
+}
+
+/// @brief comparator to sort directory entries. Sorted by name, directories first.
 ///
-/// @param a pointer to first entry
-/// @param b pointer to second entry
-/// @retval -1 if a<b
+/// @param a pointer to first sort record
+/// @param b pointer to second sort record
+/// @param names name buffer of the listing the entries belong to
+/// @retval <0 if a<b
 /// @retval 0  if a==b
-/// @retval 1  if a>b
-static int dirent_compare(const void *a, const void *b)
+/// @retval >0 if a>b
+static inline int dirent_compare(const void *a, const void *b, void *names)
 {
-  struct dirent *e1 = (struct dirent*)a;
-  struct dirent *e2 = (struct dirent*)b;
+  const struct sortrec *r1 = (const struct sortrec*)a;
+  const struct sortrec *r2 = (const struct sortrec*)b;
+
+  // the key decides unless the directory flag and the first bytes of the names are equal
+  if (r1->key != r2->key) return r1->key < r2->key ? -1 : 1;
 
-  // if one of the entries is a directory, it comes first
-  if (e1->d_type != e2->d_type) {
-    if (e1->d_type == DT_DIR) return -1;
-    if (e2->d_type == DT_DIR) return 1;
+  // otherwise sort by name
+  return strcmp((char*)names + r1->name, (char*)names + r2->name);
+}
+
+/// @brief sort @a n sort records: quicksort with median-of-three pivots and insertion sort for
+///        short ranges. Recurses into the smaller part only; ranges that partition badly too
+///        often are handed to qsort_r() to bound the worst case.
+///
+/// @param r sort records
+/// @param n number of records
+/// @param names name buffer of the listing
+/// @param budget number of partitioning rounds left before falling back to qsort_r()
+static void sortrec_sort(struct sortrec *r, size_t n, char *names, unsigned int budget)
+{
+  while (n > 16) {
+    if (budget-- == 0) {
+      qsort_r(r, n, sizeof(struct sortrec), dirent_compare, names);
+      return;
+    }
+
+    // median of three as the pivot, moved to the front
+    struct sortrec *a = &r[0], *b = &r[n/2], *c = &r[n-1], *m;
+    if (dirent_compare(a, b, names) < 0) {
+      m = (dirent_compare(b, c, names) < 0) ? b : (dirent_compare(a, c, names) < 0) ? c : a;
+    } else {
+      m = (dirent_compare(a, c, names) < 0) ? a : (dirent_compare(b, c, names) < 0) ? c : b;
+    }
+    struct sortrec pivot = *m;
+    *m = r[0];
+    r[0] = pivot;
+
+    // Hoare partition around the pivot
+    size_t i = 0, j = n;
+    for (;;) {
+      do i++; while ((i < n) && (dirent_compare(&r[i], &pivot, names) < 0));
+      do j--; while (dirent_compare(&r[j], &pivot, names) > 0);
+      if (i >= j) break;
+      struct sortrec t = r[i];
+      r[i] = r[j];
+      r[j] = t;
+    }
+    r[0] = r[j];
+    r[j] = pivot;
+
+    // recurse into the smaller part, loop on the larger one
+    if (j < n - j - 1) {
+      sortrec_sort(r, j, names, budget);
+      r += j + 1;
+      n -= j + 1;
+    } else {
+      sortrec_sort(r + j + 1, n - j - 1, names, budget);
+      n = j;
+    }
   }
 
-  // otherwise sorty by name
-  return strcmp(e1->d_name, e2->d_name);
+  // insertion sort
+  for (size_t i = 1; i < n; i++) {
+    struct sortrec t = r[i];
+    size_t j = i;
+    while ((j > 0) && (dirent_compare(&t, &r[j-1], names) < 0)) {
+      r[j] = r[j-1];
+      j--;
+    }
+    r[j] = t;
+  }
+}
+
+/// @brief number of partitioning rounds sortrec_sort() may use for @a n records (2 log2 n + 2)
+///
+/// @param n number of records
+/// @retval budget
+static unsigned int sort_budget(size_t n)
+{
+  unsigned int budget = 2;
+  for (; n > 1; n >>= 1) budget += 2;
+  return budget;
+}
+
+/// @brief byte @a d of the name of record @a r; 0 past the end of the name. The first 7 bytes
+///        are taken from the key, so the early passes do not touch the name buffer.
+///
+/// @param r sort record
+/// @param names name buffer of the listing
+/// @param d byte position. Byte d-1 of the name must not be its terminating null byte
+/// @retval byte
+static inline unsigned char sortrec_byte(const struct sortrec *r, const char *names, size_t d)
+{
+  if (d < 7) return (unsigned char)(r->key >> (55 - 8*d));
+  return (unsigned char)names[r->name + d];
+}
+
+/// @brief in-place MSD radix sort (American flag sort) of @a n records whose names share their
+///        first @a d bytes and their directory flag. Small buckets are handed to sortrec_sort().
+///
+/// @param r sort records
+/// @param n number of records
+/// @param names name buffer of the listing
+/// @param d byte position to distribute by
+static void sortrec_radix(struct sortrec *r, size_t n, char *names, size_t d)
+{
+  if (n <= 64) {
+    sortrec_sort(r, n, names, sort_budget(n));
+    return;
+  }
+
+  // count the bytes and compute the bucket boundaries
+  uint32_t count[256] = { 0 };
+  uint32_t next[256];
+  for (size_t i = 0; i < n; i++) count[sortrec_byte(&r[i], names, d)]++;
+
+  uint32_t end[256];
+  uint32_t pos = 0;
+  for (int c = 0; c < 256; c++) {
+    next[c] = pos;
+    pos += count[c];
+    end[c] = pos;
+  }
+
+  // permute in place: move every record into its bucket by following the cycles
+  for (int c = 0; c < 256; c++) {
+    while (next[c] < end[c]) {
+      struct sortrec t = r[next[c]];
+      unsigned char b = sortrec_byte(&t, names, d);
+      while (b != c) {
+        struct sortrec u = r[next[b]];
+        r[next[b]++] = t;
+        t = u;
+        b = sortrec_byte(&t, names, d);
+      }
+      r[next[c]++] = t;
+    }
+  }
+
+  // bucket 0 holds names that end here; all others continue with the next byte
+  pos = count[0];
+  for (int c = 1; c < 256; c++) {
+    if (count[c] > 1) sortrec_radix(r + pos, count[c], names, d + 1);
+    pos += count[c];
+  }
+}
+
+/// @brief sort the entries of listing @a l by name, directories first. The entries are sorted
+///        through compact (key, index) records and then gathered in order.
+///
+/// Listings with at least RADIX_THRESHOLD entries are radix sorted (unless --sort-algo says
+/// otherwise): the directories are partitioned to the front, then each part is distributed by
+/// name bytes.
+///
+/// @param l listing
+void listing_sort(struct listing *l)
+{
+  if (l->num < 2) return;
+
+  struct arena_mark mark = arena_mark(&ent_arena);
+  struct sortrec *r = (struct sortrec*)arena_alloc(&ent_arena, l->num * sizeof(struct sortrec));
+  for (size_t i = 0; i < l->num; i++) r[i] = sortrec_make(l, i);
+
+  bool radix = (sort_algo == SORT_RADIX) || ((sort_algo == SORT_AUTO) && (l->num >= RADIX_THRESHOLD));
+  if (radix) {
+    // top-level buckets: directories first (the key's top bit is clear for directories)
+    size_t ndirs = 0;
+    for (size_t i = 0; i < l->num; i++) {
+      if (!(r[i].key >> 63)) {
+        struct sortrec t = r[i];
+        r[i] = r[ndirs];
+        r[ndirs++] = t;
+      }
+    }
+    sortrec_radix(r, ndirs, l->names, 0);
+    sortrec_radix(r + ndirs, l->num - ndirs, l->names, 0);
+  }
+  else sortrec_sort(r, l->num, l->names, sort_budget(l->num));
+
+  // gather the entries in sorted order through a scratch copy
+  struct entry *tmp = (struct entry*)arena_alloc(&ent_arena, l->num * sizeof(struct entry));
+  memcpy(tmp, l->ents, l->num * sizeof(struct entry));
+  for (size_t i = 0; i < l->num; i++) l->ents[i] = tmp[r[i].idx];
+
+  arena_release(&ent_arena, mark);
 }
 //--------------------------------------------------------------------------------------------------
-// Function: gen_tree_shape
-// Generates the tree-like structure for directory printing 
-// based on whether the current entry is the last in its directory. 
-// Adds tree branches ("|", "`") if tree view flag is enabled.
+// Function: prefix_branch
+// Writes the branch slot of the current entry ("|-" or "`-" in tree view, "  " otherwise)
+// on top of the prefix stack, depending on whether the entry is the last in its directory.
+// The slot is not part of the prefix until prefix_push() is called.
 //--------------------------------------------------------------------------------------------------
-char* gen_tree_shape(bool is_last, unsigned int flags, const char *pstr) {
-	int len = strlen(pstr);// Length of the current prefix string
-	char *result;// Stores the generated tree structure
-	int warn = 0;// Error checking for memory allocation
-	// If F_TREE flag is set(-t), format the output with tree symbols
+void prefix_branch(struct prefix *p, bool is_last, unsigned int flags) {
+	// Make room for the slot
+	if(p->len + 2 > p->cap) {
+		p->cap = p->cap ? 2*p->cap : 128;
+		p->buf = (char*)xrealloc(p->buf, p->cap);
+	}
+	// If F_TREE flag is set(-t), use tree symbols
 	if(flags & F_TREE) {
-		result = (char*)malloc(sizeof(char)*(len + 3));
-		// Allocate memory for the new tree string
-		if(result == NULL) panic("Out of memory.");// Handle memory allocation failure
-		strncpy(result, pstr, len);// Copy the existing prefix
-		result[len + 2] = '\0';// Null-terminate the string
-		if(len > 1) {
-			if(result[len - 2] == '`') result[len - 2] = ' ';// Adjust the tree symbols
-			result[len - 1] = ' ';
-		}
-		result[len] = is_last ? '`' : '|';// Set tree symbol depending on last entry
-		result[len + 1] = '-';// Add horizontal branch
+		p->buf[p->len] = is_last ? '`' : '|';// Set tree symbol depending on last entry
+		p->buf[p->len + 1] = '-';// Add horizontal branch
 	}
 	else {// If tree view is not enabled, just add spaces
-		warn = asprintf(&result, "%s  ", pstr);
-		if(warn == -1) panic("Out of memory.");
+		p->buf[p->len] = p->buf[p->len + 1] = ' ';
+	}
+}
+//--------------------------------------------------------------------------------------------------
+// Function: prefix_push
+// Descends into the current entry: its branch slot becomes part of the prefix, turning
+// "|-" into "| " (more siblings follow) and "`-" into "  ".
+//--------------------------------------------------------------------------------------------------
+void prefix_push(struct prefix *p) {
+	if(p->buf[p->len] == '`') p->buf[p->len] = ' ';
+	p->buf[p->len + 1] = ' ';
+	p->len += 2;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: prefix_pop
+// Returns from a directory, dropping the innermost slot of the prefix.
+//--------------------------------------------------------------------------------------------------
+void prefix_pop(struct prefix *p) {
+	p->len -= 2;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: print_name
+// Prints the prefix, branch slot and name of an entry padded to 54 characters. In verbose
+// mode, names that do not fit are cut and end with three dots.
+//--------------------------------------------------------------------------------------------------
+void print_name(const struct prefix *p, const char *name, size_t namelen, unsigned int flags) {
+	size_t plen = p->len + 2;// prefix including the branch slot
+	if((flags & F_VERBOSE) && plen + namelen > 54) {
+		if(plen >= 51) out_write(p->buf, 51);
+		else {
+			out_write(p->buf, plen);
+			out_write(name, 51 - plen);
+		}
+		out_write("...", 3);
+	}
+	else {
+		out_write(p->buf, plen);
+		out_write(name, namelen);
+		if(plen + namelen < 54) out_fill(' ', 54 - plen - namelen);
+	}
+}
+//--------------------------------------------------------------------------------------------------
+// Function: idcache_name
+// Returns the name of a user or group id. Each id is resolved with getpwuid()/getgrgid() only
+// once per run; ids without a name (and all ids with --numeric-ids) are printed as numbers.
+//--------------------------------------------------------------------------------------------------
+const char* idcache_name(struct idcache *c, unsigned int id, unsigned int flags) {
+	// Grow the table at 50% load (or create it)
+	if(2*(c->num + 1) > c->cap) {
+		struct idname *old = c->tab;
+		size_t ocap = c->cap;
+		c->cap = ocap ? 2*ocap : 64;
+		c->tab = (struct idname*)xmalloc(c->cap * sizeof(struct idname));
+		memset(c->tab, 0, c->cap * sizeof(struct idname));
+		for(size_t i = 0; i < ocap; i++) {// Re-insert the existing names
+			if(old[i].name == NULL) continue;
+			size_t h = (old[i].id * 2654435761u) & (c->cap - 1);
+			while(c->tab[h].name) h = (h + 1) & (c->cap - 1);
+			c->tab[h] = old[i];
+		}
+		free(old);
+	}
+	// Look up the id
+	size_t h = (id * 2654435761u) & (c->cap - 1);
+	while(c->tab[h].name) {
+		if(c->tab[h].id == id) return c->tab[h].name;
+		h = (h + 1) & (c->cap - 1);
+	}
+	// Not cached yet: resolve it
+	const char *name = NULL;
+	if(!(flags & F_NUMERIC)) {
+		counters.idlookups++;
+		if(c->group) {
+			struct group *grp = getgrgid(id);// Get group information
+			if(grp) name = grp->gr_name;
+		}
+		else {
+			struct passwd *pw = getpwuid(id);// Get user information
+			if(pw) name = pw->pw_name;
+		}
+	}
+	char num[16];
+	if(name == NULL) {// No name: use the number
+		snprintf(num, sizeof(num), "%u", id);
+		name = num;
 	}
+	size_t len = strlen(name);
+	c->tab[h].id = id;
+	c->tab[h].name = (char*)xmalloc(len + 1);
+	memcpy(c->tab[h].name, name, len + 1);
+	c->num++;
 
-	return result;
+	return c->tab[h].name;
 }
 //--------------------------------------------------------------------------------------------------
 // Function: print_verbose
 // Prints detailed information about the file or directory 
 // (such as user, group, size, and type) if the verbose flag is enabled.
 //--------------------------------------------------------------------------------------------------
-void print_verbose(struct stat *stat){
-	struct passwd *pw= getpwuid(stat->st_uid);// Get user information
-	struct group *grp = getgrgid(stat->st_gid);// Get group information
-	char type;// File type character
-	// If user or group information is unavailable, panic()
-	if (pw == NULL || grp == NULL) panic("\nError on getpwuid /getgrgid.");
+void print_verbose(const struct einfo *info, unsigned int flags){
 	// Get user and group names
-	char *user = pw->pw_name;
-	char *group = grp->gr_name;
+	const char *user = idcache_name(&users, info->uid, flags);
+	const char *group = idcache_name(&groups, info->gid, flags);
+	char type;// File type character
 	// Determine file type
-	if(S_ISREG(stat->st_mode)) type = ' ';
-	else if(S_ISDIR(stat->st_mode)) type = 'd';
-	else if(S_ISCHR(stat->st_mode)) type = 'c';
-	else if(S_ISLNK(stat->st_mode)) type = 'l';
-	else if(S_ISFIFO(stat->st_mode)) type = 'f';
-	else if(S_ISBLK(stat->st_mode)) type = 'b';
-	else if(S_ISSOCK(stat->st_mode)) type = 's';
+	if(S_ISREG(info->mode)) type = ' ';
+	else if(S_ISDIR(info->mode)) type = 'd';
+	else if(S_ISCHR(info->mode)) type = 'c';
+	else if(S_ISLNK(info->mode)) type = 'l';
+	else if(S_ISFIFO(info->mode)) type = 'f';
+	else if(S_ISBLK(info->mode)) type = 'b';
+	else if(S_ISSOCK(info->mode)) type = 's';
 	else type = '\0';
 	// Print
-	printf("  %8s:%-8s  %10ld  %8ld  %c", user, group, stat->st_size, stat->st_blocks, type);
+	// Print ("  %8s:%-8s  %10ld  %8ld  %c")
+	out_write("  ", 2);
+	out_str_right(user, 8);
+	out_putc(':');
+	out_str_left(group, 8);
+	out_write("  ", 2);
+	out_num(info->size, 10);
+	out_write("  ", 2);
+	out_num(info->blocks, 8);
+	out_write("  ", 2);
+	out_putc(type);
 
 }
 //--------------------------------------------------------------------------------------------------
 // Function: print_errno
-// Handles printing error messages based on the errno value,
+// Handles printing error messages based on an errno value,
 // and appends tree structure if needed.
 //--------------------------------------------------------------------------------------------------
-void print_errno(const char *pstr, unsigned int flags){
-	// Generate tree structure with prefix
-	char *error_pstr = gen_tree_shape(true, flags, pstr);
-	switch(errno) {// Switch case based on the errno value
+void print_errno(struct prefix *p, int errnum, unsigned int flags){
+	const char *msg;// Error message
+	switch(errnum) {// Switch case based on the errno value
 		case ENOMEM:
 			panic("Out of memory.");
 			break;
                 case EACCES:
-                        printf("%sERROR: Permission denied\n", error_pstr);
+                        msg = "Permission denied";
                         break;
                 case ENOENT:
-                        printf("%sERROR: No such file or directory\n", error_pstr);
+                        msg = "No such file or directory";
                         break;
                 case ENOTDIR:
-                        printf("%sERROR: Not a directory\n", error_pstr);
+                        msg = "Not a directory";
                         break;
 		default:
 			// default error handling
-			printf("ERROR: error code %d\n", errno);
+			out_printf("ERROR: error code %d\n", errnum);
 			panic("quit process");
 	}
-	free(error_pstr);
+	// Print the error as the last entry of the directory
+	prefix_branch(p, true, flags);
+	out_write(p->buf, p->len + 2);
+	out_printf("ERROR: %s\n", msg);
 	return;
 }
 //--------------------------------------------------------------------------------------------------
+// Function: inode_first
+// Inserts the inode of an entry into the inode set. Returns true if it was not in the set yet,
+// i.e. this is the first of its names seen.
+//--------------------------------------------------------------------------------------------------
+static bool inode_first(const struct einfo *info){
+	struct inodeset *s = &inodes;
+	bool first = true;
+	pthread_mutex_lock(&s->lock);
+	// Grow the table at 75% load (or create it)
+	if(4*(s->num + 1) > 3*s->cap) {
+		struct inodekey *old = s->tab;
+		size_t ocap = s->cap;
+		s->cap = ocap ? 2*ocap : 1024;
+		s->tab = (struct inodekey*)xmalloc(s->cap * sizeof(struct inodekey));
+		memset(s->tab, 0, s->cap * sizeof(struct inodekey));
+		for(size_t i = 0; i < ocap; i++) {// Re-insert the existing inodes
+			if(old[i].ino == 0) continue;
+			size_t h = ((old[i].ino ^ (old[i].dev << 40)) * 0x9e3779b97f4a7c15ULL) & (s->cap - 1);
+			while(s->tab[h].ino) h = (h + 1) & (s->cap - 1);
+			s->tab[h] = old[i];
+		}
+		free(old);
+	}
+	// Look up the inode, inserting it if it is not there
+	size_t h = ((info->ino ^ ((uint64_t)info->dev << 40)) * 0x9e3779b97f4a7c15ULL) & (s->cap - 1);
+	while(s->tab[h].ino) {
+		if((s->tab[h].ino == info->ino) && (s->tab[h].dev == info->dev)) {
+			first = false;
+			break;
+		}
+		h = (h + 1) & (s->cap - 1);
+	}
+	if(first) {
+		s->tab[h].ino = info->ino;
+		s->tab[h].dev = info->dev;
+		s->num++;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return first;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: device_summary
+// Returns the totals of a device in the device table, adding the device if it is new.
+//--------------------------------------------------------------------------------------------------
+static struct summary *device_summary(uint32_t dev){
+	struct devtable *t = &devices;
+	if((t->last < t->num) && (t->tab[t->last].dev == dev)) return &t->tab[t->last].sum;
+	for(t->last = 0; t->last < t->num; t->last++) {
+		if(t->tab[t->last].dev == dev) return &t->tab[t->last].sum;
+	}
+	if(t->num == t->cap) {
+		t->cap = t->cap ? 2*t->cap : 8;
+		t->tab = (struct devstat*)xrealloc(t->tab, t->cap * sizeof(struct devstat));
+	}
+	memset(&t->tab[t->num], 0, sizeof(struct devstat));
+	t->tab[t->num].dev = dev;
+	return &t->tab[t->num++].sum;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: summary_add
+// Adds one entry to the statistics; its size and blocks only if bytes is set.
+//--------------------------------------------------------------------------------------------------
+static void summary_add(struct summary *stats, const struct einfo *info, bool bytes){
+	stats->files += S_ISREG(info->mode); 
+	stats->dirs += S_ISDIR(info->mode);
+	stats->links += S_ISLNK(info->mode);
+	stats->fifos += S_ISFIFO(info->mode);
+	stats->socks += S_ISSOCK(info->mode);
+	if(bytes) {
+		stats->size += info->size;
+		stats->blocks += info->blocks;
+	}
+}
+//--------------------------------------------------------------------------------------------------
 // Function: update_stats
 // Updates the summary statistics (total files, directories, links, etc.) 
-// based on the file type and size.
+// based on the file type and size. With --count-links=once, the size and blocks of a file
+// with several hard links are only added for the first of its names. With --dev-summary, the
+// entry is also added to the totals of its device.
 //--------------------------------------------------------------------------------------------------
-void update_stats(struct summary *stats, struct stat *i_stat){
-	
-	stats->files += S_ISREG(i_stat->st_mode); 
-	stats->dirs += S_ISDIR(i_stat->st_mode);
-	stats->links += S_ISLNK(i_stat->st_mode);
-	stats->fifos += S_ISFIFO(i_stat->st_mode);
-	stats->socks += S_ISSOCK(i_stat->st_mode);
-	stats->size += i_stat->st_size;
-	stats->blocks += i_stat->st_blocks;
+void update_stats(struct summary *stats, const struct einfo *info, unsigned int flags){
+	bool bytes = !((flags & F_LINKS_ONCE) && (info->nlink > 1) && !S_ISDIR(info->mode) && !inode_first(info));
+
+	summary_add(stats, info, bytes);
+	if(flags & F_DEVSUM) summary_add(device_summary(info->dev), info, bytes);
 
 	return;
 }
+//--------------------------------------------------------------------------------------------------
+// Function: summary_merge
+// Adds the statistics in src to dst.
+//--------------------------------------------------------------------------------------------------
+void summary_merge(struct summary *dst, const struct summary *src){
+	dst->files += src->files;
+	dst->dirs += src->dirs;
+	dst->links += src->links;
+	dst->fifos += src->fifos;
+	dst->socks += src->socks;
+	dst->size += src->size;
+	dst->blocks += src->blocks;
+	dst->excluded += src->excluded;
+	dst->pruned += src->pruned;
+}
 
-/// @brief recursively process directory @a dn and print its tree
-///char *next_pstr = genPstr(i == childs - 1, flags, pstr);
-/// @param dn absolute or relative path string
-/// @param pstr prefix string printed in front of each entry
-/// @param stats pointer to statistics
-/// @param flags output control flags (F_*)
-void processDir(const char *dn, const char *pstr, struct summary *stats, unsigned int flags)
-{
-	int warn=0;// Variable to track errors
-	char *new_dn = NULL;// Stores the directory path
-	int num =0;// childs
+//--------------------------------------------------------------------------------------------------
+// Function: listing_footprint
+// Estimates the memory a listing takes until its directory is printed: the entries and names
+// (with the copies left behind by growing them), the metadata and the sort scratch space.
+//--------------------------------------------------------------------------------------------------
+static size_t listing_footprint(const struct listing *l){
+	return l->cap * (2*sizeof(struct entry) + sizeof(struct einfo) + sizeof(struct sortrec) +
+	                 sizeof(struct entry)) + 2*l->ncap;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: read_listing
+// Reads all entries of the directory open on dfd into a listing and sorts them.
+// The listing is allocated from ent_arena/str_arena. Returns 0 or the errno of a read error
+// (the entries read up to the error are kept).
+// If runs is not NULL and the listing outgrows --mem-limit, it is spilled to sorted runs
+// instead: *runs is set up for merging and the listing is left empty.
+//--------------------------------------------------------------------------------------------------
+int read_listing(int dfd, struct listing *l, struct runs **runs, unsigned int flags){
+	// Set up the bulk reader on the descriptor; the record buffer is shared by all levels since
+	// the entries are copied out before descending
+	if (dbuf == NULL) dbuf = (char*)xmalloc(getdents_bufsize);
+	struct dirreader rd = { .fd = dfd, .buf = dbuf, .size = getdents_bufsize, .pos = 0, .end = 0, .err = 0 };
+	
+	// Read all directory entries, ignoring "." and ".."
+	struct arena_mark ent_mark = arena_mark(&ent_arena);
+	struct arena_mark str_mark = arena_mark(&str_arena);
+	struct linux_dirent64 *getnext_result;
+	size_t excluded = 0;
+	while((getnext_result = getNext(&rd)) != NULL) {
+		// Excluded entries are dropped right here, before they are stat()ed
+		size_t len = strlen(getnext_result->d_name);
+		if((flags & F_EXCLUDE) && is_excluded(getnext_result->d_name, len)) {
+			excluded++;
+			continue;
+		}
+		listing_push(l, getnext_result->d_ino, getnext_result->d_type, getnext_result->d_name, len);
 
-	// Ensure directory path ends with '/'
-	if (dn[strlen(dn)-1] != '/'){
-		// Add '/'
-		warn = asprintf(&new_dn, "%s/", dn);
-		if(warn == -1) panic("Out of memory.");
+		// Over budget: write the entries out as a sorted run and start over
+		if(runs && mem_limit && (listing_footprint(l) > mem_limit)) {
+			*runs = runs_spill(*runs, dfd, l, flags);
+			arena_release(&ent_arena, ent_mark);
+			arena_release(&str_arena, str_mark);
+			memset(l, 0, sizeof(*l));
+		}
 	}
-	else {// Duplicate the directory name if already properly formatted
-		new_dn = strdup(dn);
-		if (new_dn == NULL) panic("Out of memory.");
+
+	// Sort directory entries, or spill the rest and merge the runs
+	if(runs && *runs) {
+		if(l->num > 0) *runs = runs_spill(*runs, dfd, l, flags);
+		arena_release(&ent_arena, ent_mark);
+		arena_release(&str_arena, str_mark);
+		memset(l, 0, sizeof(*l));
+		runs_start(*runs);
 	}
-	// Open the directory stream
-	DIR *dir = opendir(new_dn);
-	if (!dir) {
-		print_errno(pstr, flags);// Print error if unable to open the directory
-		free(new_dn);
-		return;
+	else listing_sort(l);
+	l->excluded = excluded;
+
+	return rd.err;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: print_read_error
+// Reports an error that occurred while reading a directory on stderr.
+//--------------------------------------------------------------------------------------------------
+void print_read_error(int errnum){
+	out_flush();
+	fprintf(stderr, "%s\n", strerror(errnum));
+}
+//--------------------------------------------------------------------------------------------------
+// Function: stat_mask
+// Returns the statx fields the requested output needs: the file type to find subdirectories,
+// size and blocks for the summary, and the owner in verbose mode.
+//--------------------------------------------------------------------------------------------------
+unsigned int stat_mask(unsigned int flags){
+	unsigned int mask = STATX_TYPE;
+	if(flags & (F_SUMMARY | F_VERBOSE | F_DU)) mask |= STATX_SIZE | STATX_BLOCKS;
+	if(flags & F_VERBOSE) mask |= STATX_UID | STATX_GID;
+	if(flags & F_LINKS_ONCE) mask |= STATX_SIZE | STATX_BLOCKS | STATX_INO | STATX_NLINK;
+	if(flags & F_DEVSUM) mask |= STATX_SIZE | STATX_BLOCKS;// Any statx() reports the device
+	if(flags & F_SNAPSHOT) mask |= STATX_MODE | STATX_SIZE | STATX_BLOCKS | STATX_UID | STATX_GID |
+	                               STATX_MTIME | STATX_CTIME;
+	return mask;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: einfo_from_dtype
+// Fills in the metadata of an entry from its d_type if only the file type is needed and the
+// file system reported it. Returns false if the entry has to be stat()ed.
+//--------------------------------------------------------------------------------------------------
+bool einfo_from_dtype(struct einfo *info, const struct entry *e, unsigned int mask){
+	if((mask != STATX_TYPE) || (e->type == DT_UNKNOWN)) return false;
+
+	memset(info, 0, sizeof(*info));
+	info->mode = DTTOIF(e->type);
+	counters.stats_avoided++;
+	return true;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: statx_ns
+// Converts a statx timestamp to nanoseconds since the epoch.
+//--------------------------------------------------------------------------------------------------
+int64_t statx_ns(const struct statx_timestamp *ts){
+	return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: statx_dev
+// Returns the device of a statx result as major << 20 | minor (the kernel's encoding; 0 is
+// never a real device).
+//--------------------------------------------------------------------------------------------------
+uint32_t statx_dev(const struct statx *stx){
+	return stx->stx_dev_major << 20 | stx->stx_dev_minor;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: fd_device
+// Returns the device of an open file, or 0 if it cannot be determined.
+//--------------------------------------------------------------------------------------------------
+uint32_t fd_device(int fd){
+	struct statx stx;
+	counters.stats++;
+	if(statx(fd, "", AT_EMPTY_PATH, STATX_TYPE, &stx) < 0) return 0;
+	return statx_dev(&stx);
+}
+//--------------------------------------------------------------------------------------------------
+// Function: crosses_device
+// Returns true if the subdirectory name of dfd is on another device than dev (-x), i.e. it is
+// a mount point. The device comes with the entry's metadata if it was stat()ed; entries typed
+// from d_type alone are stat()ed here, without triggering an automount. If either device is
+// unknown, the directory is not skipped.
+//--------------------------------------------------------------------------------------------------
+bool crosses_device(int dfd, const char *name, const struct einfo *info, uint32_t dev){
+	uint32_t edev = info->dev;
+	if(edev == 0) {
+		struct statx stx;
+		counters.stats++;
+		if(statx(dfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_TYPE, &stx) < 0) return false;
+		edev = statx_dev(&stx);
 	}
-	if(errno) print_errno(pstr, flags);// Check for additional errors after opening
-	
-	// Allocate memory for directory entries and retrieve the next entry
-	struct dirent *dirents = (struct dirent*)malloc(sizeof(struct dirent));
-	if (dirents == NULL) panic("Out of memory.");
-	struct dirent *getnext_result;
-	
-	// Read all directory entries, ignoring "." and ".."
-	getnext_result = getNext(dir);
-	
-	while(getnext_result != NULL) {// Resize array
-		dirents = (struct dirent*)realloc(dirents, (num + 1) * sizeof(struct dirent));
-		if(dirents == NULL) panic("Out of memory.");
-		dirents[num++] = *getnext_result;// Store the retrieved entry
-		getnext_result = getNext(dir);// Get the next entry
+	return (dev != 0) && (edev != dev);
+}
+//--------------------------------------------------------------------------------------------------
+// Function: einfo_from_statx
+// Copies the fields dirtree needs from a statx result.
+//--------------------------------------------------------------------------------------------------
+void einfo_from_statx(struct einfo *info, const struct statx *stx){
+	info->size = stx->stx_size;
+	info->blocks = stx->stx_blocks;
+	info->mtime = statx_ns(&stx->stx_mtime);
+	info->ctime = statx_ns(&stx->stx_ctime);
+	info->mode = stx->stx_mode;
+	info->uid = stx->stx_uid;
+	info->gid = stx->stx_gid;
+	info->err = 0;
+	info->ino = stx->stx_ino;
+	info->dev = statx_dev(stx);
+	info->nlink = stx->stx_nlink;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: stat_entry
+// Retrieves the metadata of entry i of a listing relative to dfd with one statx() call; on
+// failure only the error is set.
+//--------------------------------------------------------------------------------------------------
+void stat_entry(int dfd, const struct listing *l, size_t i, struct einfo *info, unsigned int mask){
+	struct statx stx;// statx structure to hold file metadata
+	if(statx(dfd, l->names + l->ents[i].name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &stx) < 0) {
+		memset(info, 0, sizeof(*info));
+		info->err = errno;
+	}
+	else einfo_from_statx(info, &stx);
+	counters.stats++;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: stat_listing
+// Retrieves the metadata of all entries of a listing relative to dfd (single component lookups,
+// symbolic links are not followed): in one batch through io_uring with --io-uring if the
+// kernel supports it, otherwise with one statx() per entry. Only the fields in stat_mask() are
+// requested, and entries whose d_type already tells enough are not looked up at all.
+// AT_STATX_DONT_SYNC lets network file systems answer from their attribute cache instead of
+// asking the server; local file systems ignore it.
+//--------------------------------------------------------------------------------------------------
+void stat_listing(int dfd, const struct listing *l, struct einfo *info, unsigned int flags){
+	unsigned int mask = stat_mask(flags);
+	if((flags & F_URING) && (uring_stat_listing(dfd, l, info, mask) == 0)) return;
+
+	for(size_t i = 0; i < l->num; i++){
+		if(!einfo_from_dtype(&info[i], &l->ents[i], mask)) stat_entry(dfd, l, i, &info[i], mask);
 	}
-	// Sort directory entries
-	qsort(dirents, num, sizeof(struct dirent), dirent_compare);
+}
+//--------------------------------------------------------------------------------------------------
+// Function: open_subdir
+// Opens the subdirectory name of dfd and returns its descriptor, or -1 with the error in *err.
+// If the entry was not stat()ed (its type came from d_type) and the open failed because the
+// entry itself is inaccessible, *err is 0: like a failed stat, that is not reported.
+//--------------------------------------------------------------------------------------------------
+int open_subdir(int dfd, const char *name, unsigned int flags, int *err){
+	int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	*err = 0;
+	if(fd < 0) {
+		*err = errno;
+		struct stat st;
+		if((stat_mask(flags) == STATX_TYPE) && (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)) *err = 0;
+	}
+	return fd;
+}
+//--------------------------------------------------------------------------------------------------
+// Function: print_entry
+// Prints one entry: tree structure, name and, in verbose mode, the details (or the error that
+// occurred retrieving them in their place).
+//--------------------------------------------------------------------------------------------------
+void print_entry(struct prefix *pfx, const char *name, size_t namelen, const struct einfo *info,
+                 bool is_last, unsigned int flags){
+	// Set the tree structure of this entry and print the directory/file name with it
+	prefix_branch(pfx, is_last, flags);
+	print_name(pfx, name, namelen, flags);
 	
-	// Iterate through each directory entry and process
-	for(int i=0;i< num; i++){
-		char *path;// Store the full path
-		struct stat i_stat;// Stat structure to hold file metadata
-
-		// Create the full path of the current entry
-		warn = asprintf(&path, "%s%s", new_dn, dirents[i].d_name);
-		if (warn == -1) panic("Out of memory.");
-
-		// Get metadata for the current file/directory
-		lstat(path, &i_stat);
-
-		// Generate the next level tree structure
-		char *next_pstr = gen_tree_shape(i == num - 1, flags, pstr);
-		
-		// Print the directory/file name with tree structure
-		char *final_pstr;
-		warn = asprintf(&final_pstr, "%s%s", next_pstr, dirents[i].d_name);
-		if (warn == -1) panic("Out of memory.");
-
-		// Print file information and verbose details
-		if((flags & F_VERBOSE) && strlen(final_pstr) > 54) printf("%-51.51s...", final_pstr);
-		else printf("%-54s",final_pstr);
-
-		free(final_pstr);
-		
-		// If verbose mode is enabled, print additional details
-		if(flags & F_VERBOSE) print_verbose(&i_stat);
-		printf("\n");
-		
+	// If verbose mode is enabled, print additional details (or the error in their place)
+	if(flags & F_VERBOSE) {
+		if (info->err) out_printf("  %s", strerror(info->err));
+		else print_verbose(info, flags);
+	}
+	out_putc('\n');
+}
+
+/// @brief --du: append @a name to the path buffer
+///
+/// @param name entry name or, from du_root(), the root path
+/// @param len length of @a name
+/// @retval length of the path before (to be restored when the directory is done)
+static size_t du_push(const char *name, size_t len)
+{
+  size_t old = du_path.len;
+  bool sep = (old > 0) && (du_path.buf[old - 1] != '/');
+
+  if (old + sep + len > du_path.cap) {
+    while (old + sep + len > du_path.cap) du_path.cap = du_path.cap ? 2*du_path.cap : 256;
+    du_path.buf = (char*)xrealloc(du_path.buf, du_path.cap);
+  }
+  if (sep) du_path.buf[du_path.len++] = '/';
+  memcpy(du_path.buf + du_path.len, name, len);
+  du_path.len += len;
+  return old;
+}
+
+/// @brief --du: start the path buffer at root directory @a name
+///
+/// @param name path of the root directory as given on the command line
+static void du_root(const char *name)
+{
+  du_path.len = 0;
+  du_push(name, strlen(name));
+}
+
+/// @brief --du: print the row of the directory in the path buffer
+///
+/// @param sum totals of its subtree
+static void du_print(const struct summary *sum)
+{
+  out_num(sum->size, 14);
+  out_putc(' ');
+  out_num(sum->blocks, 10);
+  out_putc(' ');
+  out_num(sum->files, 10);
+  out_putc(' ');
+  out_num(sum->dirs, 10);
+  out_write("  ", 2);
+  out_write(du_path.buf, du_path.len);
+  out_putc('\n');
+}
+
+/// @brief --du: report that the directory @a name below the path buffer cannot be opened. The
+///        rows only hold directories, so the error goes to stderr.
+///
+/// @param name name of the directory
+/// @param len length of @a name
+/// @param errnum error number
+static void du_error(const char *name, size_t len, int errnum)
+{
+  size_t old = du_push(name, len);
+
+  out_flush();
+  fprintf(stderr, "%.*s: %s\n", (int)du_path.len, du_path.buf, strerror(errnum));
+  du_path.len = old;
+}
+
+/// @brief -U: read the next entry of the directory of frame @a f into its lookahead and stat it.
+///        The lookahead is empty (f->l.num == 0) at the end of the directory.
+///
+/// @param f frame
+/// @param flags output control flags (F_*)
+static void frame_next(struct frame *f, unsigned int flags)
+{
+  if (f->runs) {
+    f->l.num = runs_next(f->runs, &f->look, &f->look_info, f->look_name) ? 1 : 0;
+    return;
+  }
+
+  struct linux_dirent64 *de;
+  size_t len;
+
+  f->l.num = 0;
+  for (;;) {
+    de = getNext(&f->rd);
+    if (de == NULL) return;
+    len = strlen(de->d_name);
+    if (!(flags & F_EXCLUDE) || !is_excluded(de->d_name, len)) break;
+    f->sum.excluded++;
+  }
+
+  memcpy(f->look_name, de->d_name, len + 1);
+  f->look.ino = de->d_ino;
+  f->look.name = 0;
+  f->look.namelen = len;
+  f->look.type = de->d_type;
+  f->look_off = de->d_off;
+  f->l.num = 1;
+  stat_listing(f->fd, &f->l, f->info, flags);
+}
+
+/// @brief read, sort and stat the directory open on @a fd into a new frame on top of @a stack.
+///        With -U, only the first entry is read; a directory spilled to runs starts the merge.
+///        With --since, a directory that has not changed since the previous snapshot is listed
+///        from the snapshot instead (and with --trust-dir-mtime not stat()ed either).
+///
+/// @param stack frame stack (grown as needed)
+/// @param depth number of frames on the stack (incremented)
+/// @param cap capacity of the stack
+/// @param fd directory descriptor. Ownership passes to the frame
+/// @param flags output control flags (F_*)
+/// @param snap --snapshot: record index of the directory
+/// @param prev --since: record index of the directory in the previous snapshot or SNAP_NONE
+static void frame_push(struct frame **stack, size_t *depth, size_t *cap, int fd, unsigned int flags,
+                       uint32_t snap, uint32_t prev)
+{
+  if (*depth == *cap) {
+    *cap = *cap ? 2 * *cap : 64;
+    *stack = (struct frame*)xrealloc(*stack, *cap * sizeof(struct frame));
+    memset(*stack + *depth, 0, (*cap - *depth) * sizeof(struct frame));
+  }
+  struct frame *f = &(*stack)[(*depth)++];
+  char *buf = f->rd.buf;
+
+  memset(f, 0, sizeof(*f));
+  f->fd = fd;
+  f->rd.buf = buf;
+  f->snap = snap;
+  f->prev = prev;
+  f->ent_mark = arena_mark(&ent_arena);
+  f->str_mark = arena_mark(&str_arena);
+
+  if (flags & F_UNSORTED) {
+    if (buf == NULL) buf = (char*)xmalloc(getdents_bufsize);
+    f->rd = (struct dirreader){ .fd = fd, .buf = buf, .size = getdents_bufsize };
+  } else {
+    int err = 0;
+    bool reuse = false;
+    if (flags & F_SINCE) {
+      struct statx stx;
+      if (statx(fd, "", AT_EMPTY_PATH, STATX_TYPE | STATX_INO | STATX_MTIME | STATX_CTIME, &stx) == 0) {
+        reuse = since_unchanged(prev, &stx);
+        if (flags & F_SNAPSHOT) snap_dirstat(snap, &stx);
+      }
+      counters.stats++;
+      if (reuse) counters.dirs_reused++;
+      else counters.dirs_reread++;
+    }
+    if (reuse) since_listing(prev, &f->l);
+    else err = read_listing(fd, &f->l, &f->runs, flags);
+    f->sum.excluded = f->l.excluded;
+    if (err) print_read_error(err);
+    if (f->runs == NULL) {
+      f->info = (struct einfo*)arena_alloc(&ent_arena, f->l.num * sizeof(struct einfo));
+      if (reuse && (flags & F_TRUST_MTIME)) since_info(prev, f->info);
+      else stat_listing(fd, &f->l, f->info, flags);
+      if (flags & F_SNAPSHOT) {
+        if (err) snap_error(snap, 0, err);
+        f->snap_first = snap_dir(snap, &f->l, f->info);
+      }
+      return;
+    }
+  }
+
+  f->stream = true;
+  f->l.ents = &f->look;
+  f->l.names = f->look_name;
+  f->info = &f->look_info;
+  frame_next(f, flags);
+}
+
+/// @brief number of directory descriptors processDir keeps open: MAX_OPEN_DIRS, or fewer if
+///        RLIMIT_NOFILE leaves less than FD_RESERVE descriptors for other files beyond that
+///
+/// @retval limit (at least 2)
+static size_t open_dirs_max(void)
+{
+  static size_t max;
+
+  if (max == 0) {
+    struct rlimit rl;
+    max = MAX_OPEN_DIRS;
+    if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY) &&
+        (rl.rlim_cur < MAX_OPEN_DIRS + FD_RESERVE)) {
+      max = (rl.rlim_cur > FD_RESERVE + 2) ? rl.rlim_cur - FD_RESERVE : 2;
+    }
+  }
+  return max;
+}
+
+/// @brief close the descriptor of frame @a f to stay within the open limit, remembering the
+///        identity of the directory so that it can be verified when it is reopened. With -U the
+///        read buffer is dropped as well; reading resumes after the lookahead.
+///
+/// @param f frame
+static void frame_close(struct frame *f)
+{
+  struct stat st;
+
+  if (fstat(f->fd, &st) < 0) panic("fstat failed.");
+  f->dev = st.st_dev;
+  f->ino = st.st_ino;
+  close(f->fd);
+  f->fd = -1;
+
+  free(f->rd.buf);
+  f->rd.buf = NULL;
+}
+
+/// @brief close the descriptor of the outermost of the first @a n frames that is still open.
+///        Used when opening a directory fails because the process is out of descriptors.
+///
+/// @param stack frame stack
+/// @param n number of frames to consider
+/// @retval true if a descriptor was closed
+static bool frame_close_oldest(struct frame *stack, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    if (stack[i].fd >= 0) {
+      frame_close(&stack[i]);
+      return true;
+    }
+  }
+  return false;
+}
+
+/// @brief reopen the closed parent frame @a stack[@a i] through ".." of its child @a cfd. If ".."
+///        is no longer the same directory (it has been moved meanwhile), the rest of the frame is
+///        skipped. Out of descriptors, ancestors further up are closed to make room.
+///
+/// @param stack frame stack
+/// @param i index of the frame with a closed descriptor
+/// @param cfd descriptor of the child directory
+static void frame_reopen(struct frame *stack, size_t i, int cfd)
+{
+  struct frame *f = &stack[i];
+  struct stat st;
+
+  do {
+    f->fd = openat(cfd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  } while ((f->fd < 0) && ((errno == EMFILE) || (errno == ENFILE)) && frame_close_oldest(stack, i));
+  if ((f->fd >= 0) && (fstat(f->fd, &st) == 0) && (st.st_dev == f->dev) && (st.st_ino == f->ino)) {
+    counters.opens++;
+    if (f->stream && !f->runs) {
+      f->rd = (struct dirreader){ .fd = f->fd, .buf = (char*)xmalloc(getdents_bufsize),
+                                  .size = getdents_bufsize };
+      if (lseek(f->fd, f->look_off, SEEK_SET) < 0) f->rd.err = errno;
+    }
+    return;
+  }
+
+  print_read_error(f->fd < 0 ? errno : ESTALE);
+  if (f->fd >= 0) close(f->fd);
+  f->fd = -1;
+  if (f->stream) f->l.num = 0;
+  else f->next = f->l.num;
+}
+
+/// @brief process the directory open on @a dfd and print its tree
+///
+/// All lookups are relative to the directory file descriptor (fstatat/openat), so the kernel
+/// resolves a single path component per entry instead of re-walking the full path. Path strings
+/// are never built; only entry names are printed.
+///
+/// The walk is iterative: every directory on the current path is a frame on an explicit stack,
+/// so the depth of the tree is not limited by the thread's stack. At most MAX_OPEN_DIRS
+/// descriptors (fewer under a low RLIMIT_NOFILE) are open; ancestors above that are closed and
+/// reopened through ".." (and verified) on the way back up. If the process runs out of
+/// descriptors anyway, the outermost open ancestor is closed and the open retried.
+///
+/// Entries, names and metadata are allocated from ent_arena/str_arena and released when the
+/// directory is done, so in steady state the traversal performs no heap allocations.
+///
+/// With -U, entries are printed in directory order as they are read. One entry of lookahead
+/// tells whether the current entry is the last one, so the first line is printed right away
+/// and each directory needs constant memory however large it is.
+///
+/// Every frame adds up the totals of its subtree; when a directory is done they are added to the
+/// parent's (the root's to @a stats). With --du, no entries are printed, but each directory's
+/// row when it is done, i.e. after everything below it (post-order) in the same traversal.
+/// -L/--max-depth limits the rows (or, without --du, the entries) printed, not the walk; with
+/// --below-depth=skip, directories whose entries would be too deep are not opened at all.
+///
+/// With -x, directories on another device than @a dfd are listed but not descended into, and
+/// so are directories matching a --prune pattern. Entries matching an --exclude pattern are
+/// dropped when the directory is read, before they are stat()ed.
+///
+/// @param dfd file descriptor of an open directory. Ownership passes to processDir (closed on return)
+/// @param pfx prefix stack holding the prefix printed in front of each entry
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+void processDir(int dfd, struct prefix *pfx, struct summary *stats, unsigned int flags)
+{
+	struct frame *stack = NULL;// Directories on the current path, innermost last
+	size_t depth = 0, cap = 0;
+	uint32_t xdev = (flags & F_XDEV) ? fd_device(dfd) : 0;// Device of the root (-x)
+
+	frame_push(&stack, &depth, &cap, dfd, flags, (flags & F_SNAPSHOT) ? snap_last_root() : 0,
+	           (flags & F_SINCE) ? since_last_root() : SNAP_NONE);
+	while (depth > 0) {
+		struct frame *f = &stack[depth - 1];
+
+		// Directory done: return to the parent, reopening it if its descriptor was closed
+		if (f->next == f->l.num) {
+			if (f->rd.err) print_read_error(f->rd.err);
+			// Post-order: the subtree is complete, add its totals to the parent's (--du: and
+			// print its row)
+			if ((flags & F_DU) && (depth - 1 <= max_depth)) du_print(&f->sum);
+			if (depth > 1) summary_merge(&stack[depth - 2].sum, &f->sum);
+			else summary_merge(stats, &f->sum);
+			if (flags & F_DU) du_path.len = f->path_len;
+			if ((depth > 1) && (stack[depth - 2].fd < 0)) frame_reopen(stack, depth - 2, f->fd);
+			close(f->fd);
+			if (f->runs) runs_free(f->runs);
+			arena_release(&ent_arena, f->ent_mark);
+			arena_release(&str_arena, f->str_mark);
+			if (--depth > 0) prefix_pop(pfx);
+			continue;
+		}
+
+		// Current entry: the next one of the listing, or the lookahead, which is then replaced
+		const struct entry *e;
+		const struct einfo *info;
+		const char *name;
+		bool is_last;
+		struct entry cur;
+		struct einfo cur_info;
+		char cur_name[NAME_MAX+1];
+		if (f->stream) {
+			cur = f->look;
+			cur_info = f->look_info;
+			memcpy(cur_name, f->look_name, cur.namelen + 1);
+			e = &cur;
+			info = &cur_info;
+			name = cur_name;
+			frame_next(f, flags);
+			is_last = (f->l.num == 0);
+		}
+		else {
+			size_t i = f->next++;
+			e = &f->l.ents[i];
+			info = &f->info[i];
+			name = f->l.names + e->name;// Name of the current entry
+			is_last = (i == f->l.num - 1);
+		}
+
+		if (!(flags & F_DU) && (depth <= max_depth)) print_entry(pfx, name, e->namelen, info, is_last, flags);
+		else prefix_branch(pfx, is_last, flags);// Not printed, but its slot is pushed when descending
+		if (info->err) continue;
+
 		// Update the statistics
-		update_stats(stats, &i_stat);
-		
-		// If the current entry is a directory, recursively process it
-		if (S_ISDIR(i_stat.st_mode)) {
-			warn = asprintf(&path, "%s/", path);
-			if (warn == -1) panic("Out of memory.");
-			processDir(path, next_pstr, stats, flags);
+		update_stats(&f->sum, info, flags);
+
+		// If the current entry is a directory, descend into it (-x: unless it is a mount point)
+		if (S_ISDIR(info->mode)) {
+			// --below-depth=skip: not if its entries (--du: its row) would not be printed
+			if ((flags & F_SKIP_DEEP) && (depth >= max_depth + ((flags & F_DU) ? 1 : 0))) continue;
+			if ((flags & F_XDEV) && crosses_device(f->fd, name, info, xdev)) continue;
+			if ((flags & F_PRUNE) && is_pruned(name, e->namelen)) {
+				f->sum.pruned++;
+				continue;
+			}
+			uint32_t snap = f->snap_first + (uint32_t)(f->next - 1);// Record of the entry (--snapshot)
+			int err;
+			int cfd = open_subdir(f->fd, name, flags, &err);
+			while ((cfd < 0) && ((err == EMFILE) || (err == ENFILE)) && frame_close_oldest(stack, depth - 1)) {
+				cfd = open_subdir(f->fd, name, flags, &err);
+			}
+			prefix_push(pfx);
+			if (cfd < 0) {
+				if (err && (flags & F_DU)) du_error(name, e->namelen, err);
+				else if (err && (depth < max_depth)) print_errno(pfx, err, flags);
+				if (err && (flags & F_SNAPSHOT)) snap_error(snap, err, 0);
+				prefix_pop(pfx);
+				continue;
+			}
+			counters.opens++;
+			size_t open_max = open_dirs_max();
+			if ((depth >= open_max) && (stack[depth - open_max].fd >= 0)) frame_close(&stack[depth - open_max]);
+			size_t path_len = (flags & F_DU) ? du_push(name, e->namelen) : 0;
+			frame_push(&stack, &depth, &cap, cfd, flags, snap,
+			           (flags & F_SINCE) ? since_child(f->prev, name) : SNAP_NONE);
+			stack[depth - 1].path_len = path_len;
 		}
-		free(path);
-		free(next_pstr);
 	}
-	free(dirents);
-	free(new_dn);
-	closedir(dir);
+	for (size_t i = 0; i < cap; i++) free(stack[i].rd.buf);
+	free(stack);
 
 	return;
 }
 
 
+/// @brief add the performance counters in @a src to @a dst
+///
+/// @param dst destination
+/// @param src counters to add
+void counters_merge(struct counters *dst, const struct counters *src)
+{
+  dst->getdents += src->getdents;
+  dst->entries += src->entries;
+  dst->stats += src->stats;
+  dst->stats_avoided += src->stats_avoided;
+  dst->opens += src->opens;
+  dst->allocs += src->allocs;
+  dst->idlookups += src->idlookups;
+  dst->uring_enters += src->uring_enters;
+  dst->spills += src->spills;
+  dst->dirs_reused += src->dirs_reused;
+  dst->dirs_reread += src->dirs_reread;
+}
+
+/// @brief print the performance counters to stderr
+void print_counters(void)
+{
+  fprintf(stderr, "Statistics:\n"
+                  "  getdents64 calls:        %16llu\n"
+                  "  directory entries:       %16llu\n"
+                  "  directories opened:      %16llu\n"
+                  "  stat calls/requests:     %16llu\n"
+                  "  stat calls avoided:      %16llu\n"
+                  "  io_uring_enter calls:    %16llu\n"
+                  "  sorted runs spilled:     %16llu\n"
+                  "  directories reused:      %16llu\n"
+                  "  directories re-read:     %16llu\n"
+                  "  heap allocations:        %16llu\n"
+                  "  user/group lookups:      %16llu\n",
+                  counters.getdents, counters.entries, counters.opens, counters.stats,
+                  counters.stats_avoided, counters.uring_enters, counters.spills,
+                  counters.dirs_reused, counters.dirs_reread, counters.allocs,
+                  counters.idlookups);
+}
+
+
+/// @brief print the column header of the summary of a directory
+///
+/// @param flags output control flags (F_*)
+void print_header(unsigned int flags)
+{
+  if (flags & F_DU) out_printf("%14s %10s %10s %10s  %-51s\n", "Size", "Blocks", "Files", "Dirs", "Path");
+  else if (flags & F_VERBOSE) out_printf("Name                                                        User:Group           Size    Blocks Type \n");
+  else out_printf("Name                                                                                                \n");
+  out_printf("----------------------------------------------------------------------------------------------------\n");
+}
+
+/// @brief print one line of statistics
+///
+/// @param label text in front of the counts
+/// @param dstat statistics
+/// @param flags output control flags (F_*)
+static void print_summary_line(const char *label, const struct summary *dstat, unsigned int flags)
+{
+  char *summary;
+
+  int warn = asprintf(&summary, "%s%llu %s, %llu %s, %llu %s, %llu %s, and %llu %s", label,
+                      dstat->files, (dstat->files == 1) ? "file" : "files",
+                      dstat->dirs, (dstat->dirs == 1) ? "directory" : "directories",
+                      dstat->links, (dstat->links == 1) ? "link" : "links",
+                      dstat->fifos, (dstat->fifos == 1) ? "pipe" : "pipes",
+                      dstat->socks, (dstat->socks == 1) ? "socket" : "sockets");
+  if (warn == -1) panic("Out of memory.");
+  if (flags & F_VERBOSE) out_printf("%-68.68s   %14llu %9llu\n", summary, dstat->size, dstat->blocks);
+  else out_printf("%s\n", summary);
+  free(summary);
+}
+
+/// @brief print the summary line of a directory and, with --dev-summary, one line per device
+///        its entries are on. The device table is emptied for the next directory.
+///
+/// @param dstat statistics of the directory
+/// @param flags output control flags (F_*)
+void print_summary(const struct summary *dstat, unsigned int flags)
+{
+  out_printf("----------------------------------------------------------------------------------------------------\n");
+  print_summary_line("", dstat, flags);
+  if (flags & (F_EXCLUDE | F_PRUNE)) {
+    out_printf("%llu %s excluded, %llu %s pruned\n",
+               dstat->excluded, (dstat->excluded == 1) ? "entry" : "entries",
+               dstat->pruned, (dstat->pruned == 1) ? "directory" : "directories");
+  }
+  if (flags & F_DEVSUM) {
+    for (size_t i = 0; i < devices.num; i++) {
+      char label[32];
+      snprintf(label, sizeof(label), "  %u:%u: ", devices.tab[i].dev >> 20, devices.tab[i].dev & 0xfffff);
+      print_summary_line(label, &devices.tab[i].sum, flags);
+    }
+    devices.num = 0;
+  }
+  out_putc('\n');
+}
+
+/// @brief print the grand total of several directories
+///
+/// @param ndir number of directories
+/// @param tstat statistics of all directories together
+/// @param flags output control flags (F_*)
+void print_totals(int ndir, const struct summary *tstat, unsigned int flags)
+{
+  out_printf("Analyzed %d directories:\n"
+             "  total # of files:        %16llu\n"
+             "  total # of directories:  %16llu\n"
+             "  total # of links:        %16llu\n"
+             "  total # of pipes:        %16llu\n"
+             "  total # of sockets:      %16llu\n",
+             ndir, tstat->files, tstat->dirs, tstat->links, tstat->fifos, tstat->socks);
+  if (flags & (F_EXCLUDE | F_PRUNE)) {
+    out_printf("  total # excluded:        %16llu\n"
+               "  total # pruned:          %16llu\n",
+               tstat->excluded, tstat->pruned);
+  }
+
+  if (flags & F_VERBOSE) {
+    out_printf("  total file size:         %16llu\n"
+               "  total # of blocks:       %16llu\n",
+               tstat->size, tstat->blocks);
+  }
+}
+
+
+/// @brief parse a size argument with an optional K, M, or G suffix (powers of 1024)
+///
+/// @param str size string
+/// @param size pointer to store the parsed size
+/// @retval 0 on success
+/// @retval -1 if @a str is not a valid size
+int parse_size(const char *str, size_t *size)
+{
+  const char *end = str;
+  unsigned long long val = 0;
+
+  // digits, rejecting values that do not fit (strtoull would also accept a sign and wrap
+  // negative numbers around)
+  while ((*end >= '0') && (*end <= '9')) {
+    unsigned int digit = *end++ - '0';
+    if (val > (ULLONG_MAX - digit) / 10) return -1;
+    val = 10*val + digit;
+  }
+  if (end == str) return -1;
+
+  int shift = 0;
+  switch (*end) {
+    case 'G': case 'g': shift += 10; // fall through
+    case 'M': case 'm': shift += 10; // fall through
+    case 'K': case 'k': shift += 10; end++; break;
+  }
+  if (*end != '\0') return -1;
+  for (; shift > 0; shift -= 10) {
+    if (val > ULLONG_MAX >> 10) return -1;
+    val <<= 10;
+  }
+  if (val > SIZE_MAX) return -1;
+
+  *size = val;
+  return 0;
+}
+
+
 /// @brief print program syntax and an optional error message. Aborts the program with EXIT_FAILURE
 ///
 /// @param argv0 command line argument 0 (executable)
@@ -303,6 +1721,8 @@ void processDir(const char *dn, const char *pstr, struct summary *stats, unsigne
 /// @param ... parameter to the error format string
 void syntax(const char *argv0, const char *error, ...)
 {
+  out_flush();
+
   if (error) {
     va_list ap;
 
@@ -315,7 +1735,14 @@ void syntax(const char *argv0, const char *error, ...)
 
   assert(argv0 != NULL);
 
-  fprintf(stderr, "Usage %s [-t] [-s] [-v] [-h] [path...]\n"
+  fprintf(stderr, "Usage %s [-t] [-s] [-v] [-h] [-U] [-j N] [--numeric-ids] [--io-uring] [--stats]\n"
+                  "       [--getdents-buf=SIZE] [--sort-algo=auto|compare|radix] [--mem-limit=SIZE]\n"
+                  "       [--snapshot=FILE] [--since=FILE [--trust-dir-mtime]] [--du]\n"
+                  "       [-L N [--below-depth=walk|skip]] [--count-links=once|always] [-x] [--dev-summary]\n"
+                  "       [--exclude=GLOB]... [--prune=GLOB]... [path...]\n"
+                  "       %s [-t] [-s] [-v] --from-snapshot=FILE\n"
+                  "       %s --diff OLD NEW\n"
+                  "       %s [-t] [-s] [-v] --watch [--watch-socket=PATH] [path...]\n"
                   "Gather information about directory trees. If no path is given, the current directory\n"
                   "is analyzed.\n"
                   "\n"
@@ -324,8 +1751,70 @@ void syntax(const char *argv0, const char *error, ...)
                   " -s        print summary of directories (total number of files, total file size, etc)\n"
                   " -v        print detailed information for each file. Turns on tree view.\n"
                   " -h        print this help\n"
+                  " -U, --unsorted\n"
+                  "           print entries in directory order as they are read instead of sorted\n"
+                  "           (sequential; -j is ignored)\n"
+                  " -j N      read directories with N threads (max %d). The output is identical.\n"
+                  " --numeric-ids\n"
+                  "           print user and group ids instead of names\n"
+                  " --io-uring\n"
+                  "           retrieve the metadata of a directory's entries in one batch of io_uring\n"
+                  "           statx requests (falls back to fstatat if io_uring is not available)\n"
+                  " --stats   print system call counters to stderr when done\n"
+                  " --getdents-buf=SIZE\n"
+                  "           size of the directory read buffer, K/M/G suffixes allowed (default 32K)\n"
+                  " --sort-algo=auto|compare|radix\n"
+                  "           sort entries with a comparison sort, an MSD radix sort, or (auto, default)\n"
+                  "           radix sort directories with at least %d entries\n"
+                  " --mem-limit=SIZE\n"
+                  "           memory budget of a directory listing, K/M/G suffixes allowed; larger\n"
+                  "           directories are sorted through temporary files (sequential; -j is ignored)\n"
+                  " --snapshot=FILE\n"
+                  "           also write a binary snapshot of the traversal to FILE (not with -U or\n"
+                  "           --mem-limit)\n"
+                  " --since=FILE\n"
+                  "           take the entries of directories that have not changed (same inode,\n"
+                  "           mtime and ctime) since snapshot FILE from there instead of reading them;\n"
+                  "           their metadata is still retrieved (sequential; -j is ignored)\n"
+                  " --trust-dir-mtime\n"
+                  "           with --since, also take the metadata of their entries from the snapshot\n"
+                  " --from-snapshot=FILE\n"
+                  "           print the trees recorded in snapshot FILE instead of traversing directories\n"
+                  " --watch   load the trees into memory, keep them current with inotify and print\n"
+                  "           them (like a normal run) on SIGUSR1, until SIGINT/SIGTERM\n"
+                  " --watch-socket=PATH\n"
+                  "           with --watch, answer requests on Unix socket PATH: \"tree\" (default)\n"
+                  "           prints the full output, \"summary\" the totals of each path\n"
+                  " --du      print only directories, each with the totals (size, blocks, files and\n"
+                  "           subdirectories) of its subtree, after its subdirectories (sequential;\n"
+                  "           -j is ignored)\n"
+                  " -L N, --max-depth=N\n"
+                  "           print only entries (with --du: directories) at most N levels below the\n"
+                  "           paths (sequential; -j is ignored)\n"
+                  " --below-depth=walk|skip\n"
+                  "           with -L, still read the levels below N for the totals (walk, default) or\n"
+                  "           do not read them at all (skip; the totals cover the levels printed only)\n"
+                  " --count-links=once|always\n"
+                  "           add the size of a file with several hard links once (for the first name\n"
+                  "           found) or for every name (always, default)\n"
+                  " -x, --one-file-system\n"
+                  "           do not descend into directories on other file systems (mount points are\n"
+                  "           listed, but not their contents)\n"
+                  " --dev-summary\n"
+                  "           add the totals of each device (major:minor) below the summary of each path;\n"
+                  "           turns on -s (sequential; -j is ignored)\n"
+                  " --exclude=GLOB\n"
+                  "           leave out entries whose name matches GLOB (not listed, counted or\n"
+                  "           descended into); may be given several times\n"
+                  " --prune=GLOB\n"
+                  "           list directories whose name matches GLOB, but do not descend into them;\n"
+                  "           may be given several times\n"
+                  " --diff OLD NEW\n"
+                  "           compare snapshots OLD and NEW: list added (A), removed (D), resized (M),\n"
+                  "           type-changed (T) and not comparable (?) entries and the total size delta\n"
+                  "           (S) of every changed directory. Exits with 1 if they differ, 2 on error.\n"
                   " path...   list of space-separated paths (max %d). Default is the current directory.\n",
-                  basename(argv0), MAX_DIR);
+                  basename(argv0), basename(argv0), basename(argv0), basename(argv0), MAX_JOBS, RADIX_THRESHOLD, MAX_DIR);
 
   exit(EXIT_FAILURE);
 }
@@ -342,7 +1831,15 @@ int main(int argc, char *argv[])
   int   ndir = 0;
 
   struct summary tstat;
+  struct prefix pfx = { 0 };
   unsigned int flags = 0;
+  unsigned int jobs = 0;
+  const char *snapout = NULL;
+  const char *snapin = NULL;
+  const char *since = NULL;
+  bool watch = false;
+  const char *watchsock = NULL;
+  const char *diff[2] = { NULL, NULL };
 
   //
   // parse arguments
@@ -354,19 +1851,155 @@ int main(int argc, char *argv[])
       else if (!strcmp(argv[i], "-s")) flags |= F_SUMMARY;
       else if (!strcmp(argv[i], "-v")) flags |= F_VERBOSE;
       else if (!strcmp(argv[i], "-h")) syntax(argv[0], NULL);
+      else if (!strcmp(argv[i], "-U") || !strcmp(argv[i], "--unsorted")) flags |= F_UNSORTED;
+      else if (!strncmp(argv[i], "-j", 2)) {
+        // format: "-j N" or "-jN"
+        const char *arg = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+        char *end;
+        long n = strtol(arg, &end, 10);
+        if ((*arg == '\0') || (*end != '\0') || (n < 1) || (n > MAX_JOBS))
+          syntax(argv[0], "Invalid number of threads '%s'.", arg);
+        jobs = n;
+      }
+      else if (!strcmp(argv[i], "--stats")) flags |= F_STATS;
+      else if (!strcmp(argv[i], "--numeric-ids")) flags |= F_NUMERIC;
+      else if (!strcmp(argv[i], "--io-uring")) flags |= F_URING;
+      else if (!strncmp(argv[i], "--getdents-buf=", 15)) {
+        if ((parse_size(argv[i] + 15, &getdents_bufsize) < 0) || (getdents_bufsize < 1024))
+          syntax(argv[0], "Invalid buffer size '%s' (minimum 1K).", argv[i] + 15);
+      }
+      else if (!strncmp(argv[i], "--snapshot=", 11) && argv[i][11]) {
+        snapout = argv[i] + 11;
+        flags |= F_SNAPSHOT;
+      }
+      else if (!strncmp(argv[i], "--from-snapshot=", 16) && argv[i][16]) snapin = argv[i] + 16;
+      else if (!strncmp(argv[i], "--since=", 8) && argv[i][8]) {
+        since = argv[i] + 8;
+        flags |= F_SINCE;
+      }
+      else if (!strcmp(argv[i], "--trust-dir-mtime")) flags |= F_TRUST_MTIME;
+      else if (!strcmp(argv[i], "--du")) flags |= F_DU;
+      else if (!strncmp(argv[i], "--below-depth=", 14)) {
+        const char *mode = argv[i] + 14;
+        if      (!strcmp(mode, "walk")) flags &= ~F_SKIP_DEEP;
+        else if (!strcmp(mode, "skip")) flags |= F_SKIP_DEEP;
+        else syntax(argv[0], "Invalid mode '%s' for --below-depth.", mode);
+      }
+      else if (!strcmp(argv[i], "-x") || !strcmp(argv[i], "--one-file-system")) flags |= F_XDEV;
+      else if (!strcmp(argv[i], "--dev-summary")) flags |= F_DEVSUM | F_SUMMARY;
+      else if (!strncmp(argv[i], "--exclude=", 10) && argv[i][10]) {
+        exclude_add(argv[i] + 10);
+        flags |= F_EXCLUDE;
+      }
+      else if (!strncmp(argv[i], "--prune=", 8) && argv[i][8]) {
+        prune_add(argv[i] + 8);
+        flags |= F_PRUNE;
+      }
+      else if (!strncmp(argv[i], "--count-links=", 14)) {
+        const char *mode = argv[i] + 14;
+        if      (!strcmp(mode, "once")) flags |= F_LINKS_ONCE;
+        else if (!strcmp(mode, "always")) flags &= ~F_LINKS_ONCE;
+        else syntax(argv[0], "Invalid hard link mode '%s'.", mode);
+      }
+      else if (!strncmp(argv[i], "--max-depth=", 12) || !strncmp(argv[i], "-L", 2)) {
+        // format: "--max-depth=N", "-L N" or "-LN"
+        const char *arg = (argv[i][1] == '-') ? argv[i] + 12 :
+                          argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+        char *end;
+        long n = strtol(arg, &end, 10);
+        if ((*arg == '\0') || (*end != '\0') || (n < 0) || (n >= UINT_MAX))
+          syntax(argv[0], "Invalid depth '%s'.", arg);
+        max_depth = n;
+      }
+      else if (!strcmp(argv[i], "--watch")) watch = true;
+      else if (!strncmp(argv[i], "--watch-socket=", 15) && argv[i][15]) watchsock = argv[i] + 15;
+      else if (!strcmp(argv[i], "--diff")) {
+        // format: "--diff OLD NEW"
+        if (i + 2 >= argc) syntax(argv[0], "--diff requires two snapshot files.");
+        diff[0] = argv[++i];
+        diff[1] = argv[++i];
+      }
+      else if (!strncmp(argv[i], "--mem-limit=", 12)) {
+        if ((parse_size(argv[i] + 12, &mem_limit) < 0) || (mem_limit < 64*1024))
+          syntax(argv[0], "Invalid memory limit '%s' (minimum 64K).", argv[i] + 12);
+      }
+      else if (!strncmp(argv[i], "--sort-algo=", 12)) {
+        const char *algo = argv[i] + 12;
+        if      (!strcmp(algo, "auto")) sort_algo = SORT_AUTO;
+        else if (!strcmp(algo, "compare")) sort_algo = SORT_COMPARE;
+        else if (!strcmp(algo, "radix")) sort_algo = SORT_RADIX;
+        else syntax(argv[0], "Invalid sort algorithm '%s'.", algo);
+      }
       else syntax(argv[0], "Unrecognized option '%s'.", argv[i]);
     } else {
       // anything else is recognized as a directory
       if (ndir < MAX_DIR) {
         directories[ndir++] = argv[i];
       } else {
-        printf("Warning: maximum number of directories exceeded, ignoring '%s'.\n", argv[i]);
+        out_printf("Warning: maximum number of directories exceeded, ignoring '%s'.\n", argv[i]);
       }
     }
   }
 
+  if (diff[0]) {
+    if (snapout || snapin || (ndir > 0)) syntax(argv[0], "--diff takes no paths and no other snapshot options.");
+    int ret = snap_diff(diff[0], diff[1]);
+    out_flush();
+    return ret;
+  }
+
+  // watch mode keeps its own tree and runs until it is stopped
+  if (watchsock && !watch) syntax(argv[0], "--watch-socket requires --watch.");
+  if (watch) {
+    if (snapout || snapin || since || mem_limit || (max_depth != UINT_MAX) ||
+        (flags & (F_UNSORTED | F_DU | F_LINKS_ONCE | F_XDEV | F_DEVSUM | F_EXCLUDE | F_PRUNE)))
+      syntax(argv[0], "--watch cannot be combined with snapshots, -U, --mem-limit, --du, --max-depth,\n"
+                      "--count-links=once, -x, --dev-summary, --exclude or --prune.");
+    if (ndir == 0) directories[ndir++] = CURDIR;
+    return watch_run(directories, ndir, watchsock, flags);
+  }
+
+  // snapshots: the records of a directory's entries must be written all at once, so the
+  // streaming modes are out; when rendering a snapshot its roots take the place of the paths
+  if (snapout && ((flags & F_UNSORTED) || mem_limit))
+    syntax(argv[0], "--snapshot cannot be combined with -U or --mem-limit.");
+  if (snapin) {
+    if (snapout || (ndir > 0)) syntax(argv[0], "--from-snapshot takes no paths and no --snapshot.");
+    if ((flags & (F_DU | F_LINKS_ONCE | F_XDEV | F_DEVSUM | F_EXCLUDE | F_PRUNE)) || (max_depth != UINT_MAX))
+      syntax(argv[0], "--from-snapshot cannot be combined with --du, --max-depth, --count-links=once,\n"
+                      "-x, --dev-summary, --exclude or --prune.");
+    if (snap_load(snapin) < 0) {
+      perror(snapin);
+      return EXIT_FAILURE;
+    }
+    ndir = snap_nroots();
+    for (int i = 0; i < ndir; i++) directories[i] = snap_root_name(i);
+    jobs = 0;
+  }
+  if (since) {
+    if ((flags & (F_UNSORTED | F_EXCLUDE | F_PRUNE)) || mem_limit || snapin)
+      syntax(argv[0], "--since cannot be combined with -U, --mem-limit, --from-snapshot, --exclude or --prune.");
+    if (since_load(since) < 0) {
+      perror(since);
+      return EXIT_FAILURE;
+    }
+    jobs = 0;
+  }
+  else if (flags & F_TRUST_MTIME) syntax(argv[0], "--trust-dir-mtime requires --since.");
+  if ((flags & F_SKIP_DEEP) && (max_depth == UINT_MAX))
+    syntax(argv[0], "--below-depth=skip requires -L or --max-depth.");
+  // snapshots do not record link counts and devices
+  if ((flags & F_TRUST_MTIME) && (flags & (F_LINKS_ONCE | F_DEVSUM)))
+    syntax(argv[0], "--trust-dir-mtime cannot be combined with --count-links=once or --dev-summary.");
+  if (snapout) snap_create(snapout);
+
   // if no directory was specified, use the current directory
-  if (ndir == 0) directories[ndir++] = CURDIR;
+  if ((ndir == 0) && !snapin) directories[ndir++] = CURDIR;
+
+  // the streaming modes print entries as they are read or merged, which the thread pool
+  // cannot do; neither does it aggregate subtrees, limit the depth or total per device
+  if ((flags & (F_UNSORTED | F_DU | F_DEVSUM)) || mem_limit || (max_depth != UINT_MAX)) jobs = 0;
+  if (jobs > 0) pool_start(jobs, flags);
 
 
   //
@@ -387,58 +2020,45 @@ int main(int argc, char *argv[])
 
   for(int i=0;i<ndir;i++){
 	  struct summary dstat = {0};// each directory summary
-	  if(flags & F_SUMMARY) {
-	  	if(flags & F_VERBOSE) printf("Name                                                        User:Group           Size    Blocks Type \n");
-	  	else printf("Name                                                                                                \n");
-		printf("----------------------------------------------------------------------------------------------------\n");
-	  }
-	  printf("%s\n",directories[i]);
+	  if(flags & F_SUMMARY) print_header(flags);
+	  if (flags & F_DU) du_root(directories[i]);
+	  else out_printf("%s\n",directories[i]);
+	  if (flags & F_SNAPSHOT) snap_root(directories[i]);
+	  if (flags & F_SINCE) since_root(directories[i]);
 	  //recursively find
-	  processDir(directories[i], "",&dstat, flags);
+	  if (snapin) processSnapshot(i, &pfx, &dstat, flags);
+	  else if (jobs > 0) processDirParallel(directories[i], &pfx, &dstat, flags);
+	  else {
+		  int dfd = open(directories[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		  if (dfd < 0) {
+			  int err = errno;
+			  if (flags & F_DU) {
+				  out_flush();
+				  fprintf(stderr, "%s: %s\n", directories[i], strerror(err));
+			  }
+			  else print_errno(&pfx, err, flags);
+			  if (flags & F_SNAPSHOT) snap_error(snap_last_root(), err, 0);
+		  }
+		  else {
+			  counters.opens++;
+			  processDir(dfd, &pfx, &dstat, flags);
+		  }
+	  }
 	  if(flags & F_SUMMARY){
-		  //print
-		  char *summary;
-		  printf("----------------------------------------------------------------------------------------------------\n");
-		  int warn = asprintf(&summary,"%u %s, %u %s, %u %s, %u %s, and %u %s",
-				  dstat.files, (dstat.files==1) ? "file":"files",
-				  dstat.dirs, (dstat.dirs==1) ? "directory":"directories",
-				  dstat.links, (dstat.links==1) ? "link":"links",
-				  dstat.fifos, (dstat.fifos==1) ? "pipe":"pipes",
-				  dstat.socks, (dstat.socks==1) ? "socket":"sockets");
-		  if(warn==-1) panic("Out of memory.");
-		  if(flags & F_VERBOSE) printf("%-68.68s   %14lld %9lld\n\n", summary, dstat.size, dstat.blocks);
-		  else printf("%s\n\n", summary);
-		  
-		  tstat.blocks += dstat.blocks;
-		  tstat.size += dstat.size;
-		  tstat.files += dstat.files;
-		  tstat.dirs += dstat.dirs;
-		  tstat.links += dstat.links;
-		  tstat.fifos += dstat.fifos;
-		  tstat.socks += dstat.socks;
-		  
-		  free(summary);
+		  print_summary(&dstat, flags);
+		  summary_merge(&tstat, &dstat);
 	  }
   }
   //
   // print grand total
   //
-  if ((flags & F_SUMMARY) && (ndir > 1)) {
-    printf("Analyzed %d directories:\n"
-           "  total # of files:        %16d\n"
-           "  total # of directories:  %16d\n"
-           "  total # of links:        %16d\n"
-           "  total # of pipes:        %16d\n"
-           "  total # of sockets:      %16d\n",
-           ndir, tstat.files, tstat.dirs, tstat.links, tstat.fifos, tstat.socks);
-
-    if (flags & F_VERBOSE) {
-      printf("  total file size:         %16llu\n"
-             "  total # of blocks:       %16llu\n",
-             tstat.size, tstat.blocks);
-    }
+  if ((flags & F_SUMMARY) && (ndir > 1)) print_totals(ndir, &tstat, flags);
 
-  }
+  if (jobs > 0) pool_stop();
+  if (snapout) snap_finish();
+
+  out_flush();
+  if (flags & F_STATS) print_counters();
 
   //
   // that's all, folks!
@@ -0,0 +1,314 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                     Fall 2024
+//
+/// @file
+/// @brief data structures and functions shared by the dirtree modules
+/// @author <Jeon minseo>
+/// @studid <2019-19932>
+//--------------------------------------------------------------------------------------------------
+
+#ifndef DIRTREE_H
+#define DIRTREE_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <endian.h>
+#include <limits.h>
+#include <assert.h>
+#include <grp.h>
+#include <pwd.h>
+
+/// @brief output control flags
+#define F_TREE      0x1       ///< enable tree view
+#define F_SUMMARY   0x2       ///< enable summary
+#define F_VERBOSE   0x4       ///< turn on verbose mode
+#define F_STATS     0x8       ///< print performance counters
+#define F_NUMERIC   0x10      ///< print numeric user and group ids
+#define F_URING     0x20      ///< retrieve metadata with batched io_uring statx requests
+#define F_UNSORTED  0x40      ///< print entries in directory order as they are read (-U)
+#define F_SNAPSHOT  0x80      ///< write a binary snapshot of the traversal (--snapshot)
+#define F_SINCE     0x100     ///< reuse the listings of unchanged directories (--since)
+#define F_TRUST_MTIME 0x200   ///< --since: also reuse the metadata of their entries
+#define F_DU        0x400     ///< print the recursive totals of each directory in post-order (--du)
+#define F_LINKS_ONCE 0x800    ///< count the size of hard-linked files once (--count-links=once)
+#define F_XDEV      0x1000    ///< do not descend into directories on other devices (-x)
+#define F_DEVSUM    0x2000    ///< break the summary down by device (--dev-summary)
+#define F_EXCLUDE   0x4000    ///< drop entries matching an --exclude pattern
+#define F_PRUNE     0x8000    ///< do not descend into directories matching a --prune pattern
+#define F_SKIP_DEEP 0x10000   ///< do not read directories below the -L limit (--below-depth=skip)
+
+#define MAX_DIR     64        ///< maximum number of supported directories
+#define MAX_JOBS    256       ///< maximum number of threads (-j)
+
+#define SORT_AUTO     0       ///< --sort-algo=auto: radix sort for large directories, else compare
+#define SORT_COMPARE  1       ///< --sort-algo=compare: key quicksort
+#define SORT_RADIX    2       ///< --sort-algo=radix: MSD radix (American flag) sort
+#define RADIX_THRESHOLD 4096  ///< directories with at least this many entries are radix sorted (auto)
+#define MAX_OPEN_DIRS 64      ///< directory descriptors kept open by processDir; ancestors further
+                              ///< up are closed and reopened through ".." when the walk returns
+#define FD_RESERVE  16        ///< descriptors left for other files when RLIMIT_NOFILE lowers the
+                              ///< number of directories kept open below MAX_OPEN_DIRS
+#define SNAP_NONE   UINT32_MAX ///< no snapshot record
+
+/// @brief struct holding the summary. All counters are 64 bits wide so that totals over several
+///        huge trees (and the merged totals of the -j workers) cannot wrap; with no padding,
+///        merging two summaries is a run of independent 64-bit additions.
+struct summary {
+  unsigned long long dirs;    ///< number of directories encountered
+  unsigned long long files;   ///< number of files
+  unsigned long long links;   ///< number of links
+  unsigned long long fifos;   ///< number of pipes
+  unsigned long long socks;   ///< number of sockets
+
+  unsigned long long size;    ///< total size (in bytes)
+  unsigned long long blocks;  ///< total number of blocks (512 byte blocks)
+  unsigned long long excluded; ///< number of entries dropped by --exclude
+  unsigned long long pruned;  ///< number of directories not descended into (--prune)
+};
+
+
+/// @brief raw directory entry as returned by the getdents64 system call
+struct linux_dirent64 {
+  ino64_t        d_ino;       ///< inode number
+  off64_t        d_off;       ///< offset to the next entry
+  unsigned short d_reclen;    ///< length of this record
+  unsigned char  d_type;      ///< file type (DT_*)
+  char           d_name[];    ///< null-terminated file name
+};
+
+/// @brief bulk directory reader. Entries are pulled in with getdents64 into a (large) buffer and
+///        handed out in place without copying.
+struct dirreader {
+  int    fd;                  ///< directory file descriptor
+  char   *buf;                ///< record buffer
+  size_t size;                ///< size of buf
+  size_t pos;                 ///< offset of the next record in buf
+  size_t end;                 ///< number of valid bytes in buf
+  int    err;                 ///< errno of a failed read, 0 otherwise
+};
+
+/// @brief compact directory entry. The name is stored in the name buffer of the owning listing.
+struct entry {
+  uint64_t ino;               ///< inode number
+  uint32_t name;              ///< offset of the null-terminated name in the name buffer
+  uint16_t namelen;           ///< length of the name (without the terminating null byte)
+  uint8_t  type;              ///< file type (DT_*)
+};
+
+/// @brief entries of a directory. Both arrays grow geometrically.
+struct listing {
+  struct entry *ents;         ///< entries
+  size_t num;                 ///< number of entries
+  size_t cap;                 ///< capacity of ents
+  char   *names;              ///< name buffer holding the null-terminated names back to back
+  size_t nlen;                ///< used bytes in names
+  size_t ncap;                ///< capacity of names
+  size_t excluded;            ///< number of entries dropped by --exclude while reading
+};
+
+/// @brief metadata of a directory entry; the subset of struct stat dirtree needs
+struct einfo {
+  int64_t  size;              ///< size in bytes
+  int64_t  blocks;            ///< number of 512 byte blocks
+  int64_t  mtime;             ///< modification time (ns since the epoch; with --snapshot)
+  int64_t  ctime;             ///< status change time (ns since the epoch; with --snapshot)
+  uint32_t mode;              ///< file type and mode
+  uint32_t uid;               ///< user id
+  uint32_t gid;               ///< group id
+  int32_t  err;               ///< errno if the metadata could not be retrieved, 0 otherwise
+  uint64_t ino;               ///< inode number (with --count-links=once)
+  uint32_t dev;               ///< device, major << 20 | minor; 0 if the entry was not stat()ed
+  uint32_t nlink;             ///< number of hard links (with --count-links=once)
+};
+
+/// @brief tree prefix printed in front of entries, kept as a stack with one two-character slot
+///        per directory level ("| " or "  "). The slot of the current entry ("|-", "`-" or "  ")
+///        is written right above the top.
+struct prefix {
+  char   *buf;                ///< slots; not null-terminated
+  size_t len;                 ///< length of the prefix (2 per level)
+  size_t cap;                 ///< capacity of buf
+};
+
+/// @brief growable memory buffer; output can be captured into one (out_capture())
+struct membuf {
+  char   *buf;                ///< data; not null-terminated
+  size_t len;                 ///< number of bytes
+  size_t cap;                 ///< capacity of buf
+};
+
+/// @brief memory chunk of an arena
+struct arena_chunk {
+  struct arena_chunk *next;   ///< next chunk (chunks are kept for reuse after a release)
+  size_t size;                ///< size of data
+  char   data[];              ///< memory handed out by the arena
+};
+
+/// @brief bump allocator. Memory is released in stack order by resetting to a mark; chunks are
+///        never returned to the heap, so a traversal in steady state performs no malloc/free.
+struct arena {
+  struct arena_chunk *first;  ///< first chunk
+  struct arena_chunk *cur;    ///< chunk allocations are served from (NULL: none yet)
+  size_t top;                 ///< offset of the first free byte in cur
+};
+
+/// @brief saved arena state, see arena_mark() and arena_release()
+struct arena_mark {
+  struct arena_chunk *chunk;  ///< current chunk at the time of the mark
+  size_t top;                 ///< top at the time of the mark
+};
+
+struct runs;                  ///< sorted runs of a spilled directory (extsort.c)
+
+/// @brief directory on processDir's explicit stack (one per level of the current path).
+///        Sorted, l holds all entries; unsorted (-U), l holds just the one-entry lookahead
+///        and the directory is read through rd as the walk goes. Directories spilled to sorted
+///        runs (--mem-limit) also go through the lookahead, fed by the merge.
+struct frame {
+  struct listing l;           ///< sorted entries (allocated from the arenas) or the lookahead
+  struct einfo *info;         ///< metadata of the entries (allocated from the arenas)
+  size_t next;                ///< index of the next entry to print
+  int fd;                     ///< directory descriptor; -1 while closed to stay within the open limit
+  uint64_t dev;               ///< device of the directory (valid while fd is closed)
+  uint64_t ino;               ///< inode of the directory (valid while fd is closed)
+  struct arena_mark ent_mark; ///< ent_arena state before the directory was read
+  struct arena_mark str_mark; ///< str_arena state before the directory was read
+  struct runs *runs;          ///< spilled sorted runs being merged (--mem-limit), or NULL
+  bool stream;                ///< entries come one by one through the lookahead (-U or runs)
+  struct dirreader rd;        ///< -U: reader; the buffer is kept in the stack slot for reuse
+  struct entry look;          ///< -U: lookahead entry
+  struct einfo look_info;     ///< -U: metadata of the lookahead entry
+  int64_t look_off;           ///< -U: directory offset following the lookahead (d_off)
+  char look_name[NAME_MAX+1]; ///< -U: name of the lookahead entry
+  uint32_t snap;              ///< --snapshot: record index of the directory
+  uint32_t snap_first;        ///< --snapshot: record index of its first entry
+  uint32_t prev;              ///< --since: record index of the directory in the previous snapshot
+  struct summary sum;         ///< totals of the subtree read so far
+  size_t path_len;            ///< --du: length of the parent's path in the path buffer
+};
+
+#define ARENA_CHUNK (64*1024)  ///< minimum arena chunk size
+#define ARENA_ALIGN 8          ///< alignment of arena allocations
+
+/// @brief performance counters, printed with --stats
+struct counters {
+  unsigned long long getdents;  ///< number of getdents64 system calls
+  unsigned long long entries;   ///< number of directory entries returned (without '.' and '..')
+  unsigned long long stats;     ///< number of statx calls or requests
+  unsigned long long stats_avoided; ///< number of entries whose type was taken from d_type
+  unsigned long long opens;     ///< number of directories opened
+  unsigned long long allocs;    ///< number of heap allocations (malloc/realloc)
+  unsigned long long idlookups; ///< number of getpwuid/getgrgid calls
+  unsigned long long uring_enters; ///< number of io_uring_enter system calls
+  unsigned long long spills;    ///< number of sorted runs spilled to temporary files
+  unsigned long long dirs_reused; ///< --since: directories listed from the previous snapshot
+  unsigned long long dirs_reread; ///< --since: directories read because they changed
+};
+
+extern __thread struct counters counters;  ///< performance counters of the calling thread
+extern __thread struct arena ent_arena;    ///< arena for entry arrays of the calling thread
+extern __thread struct arena str_arena;    ///< arena for names of the calling thread
+extern size_t getdents_bufsize;            ///< size of the getdents64 buffer
+extern unsigned int sort_algo;             ///< sort algorithm (SORT_*)
+extern size_t mem_limit;                   ///< memory budget of a directory listing (0: none)
+
+
+// memory management
+void panic(const char *msg);
+void *xmalloc(size_t size);
+void *xrealloc(void *ptr, size_t size);
+void *arena_alloc(struct arena *a, size_t size);
+void *arena_grow(struct arena *a, void *p, size_t old, size_t size);
+struct arena_mark arena_mark(struct arena *a);
+void arena_release(struct arena *a, struct arena_mark m);
+
+// reading directories
+void listing_push(struct listing *l, uint64_t ino, unsigned char type, const char *name, size_t len);
+void listing_sort(struct listing *l);
+int read_listing(int dfd, struct listing *l, struct runs **runs, unsigned int flags);
+void print_read_error(int errnum);
+unsigned int stat_mask(unsigned int flags);
+bool einfo_from_dtype(struct einfo *info, const struct entry *e, unsigned int mask);
+void einfo_from_statx(struct einfo *info, const struct statx *stx);
+void stat_entry(int dfd, const struct listing *l, size_t i, struct einfo *info, unsigned int mask);
+int64_t statx_ns(const struct statx_timestamp *ts);
+uint32_t statx_dev(const struct statx *stx);
+uint32_t fd_device(int fd);
+bool crosses_device(int dfd, const char *name, const struct einfo *info, uint32_t dev);
+void stat_listing(int dfd, const struct listing *l, struct einfo *info, unsigned int flags);
+int open_subdir(int dfd, const char *name, unsigned int flags, int *err);
+
+// output
+void out_flush(void);
+struct membuf *out_capture(struct membuf *m);
+void out_printf(const char *fmt, ...);
+void prefix_push(struct prefix *p);
+void prefix_pop(struct prefix *p);
+void print_entry(struct prefix *pfx, const char *name, size_t namelen, const struct einfo *info,
+                 bool is_last, unsigned int flags);
+void print_errno(struct prefix *p, int errnum, unsigned int flags);
+void print_header(unsigned int flags);
+void print_summary(const struct summary *dstat, unsigned int flags);
+void print_totals(int ndir, const struct summary *tstat, unsigned int flags);
+void update_stats(struct summary *stats, const struct einfo *info, unsigned int flags);
+void summary_merge(struct summary *dst, const struct summary *src);
+void counters_merge(struct counters *dst, const struct counters *src);
+
+// parallel traversal (pwalk.c)
+void pool_start(unsigned int nthreads, unsigned int flags);
+void pool_stop(void);
+void processDirParallel(const char *dn, struct prefix *pfx, struct summary *stats, unsigned int flags);
+
+// external sort of large listings (extsort.c)
+struct runs *runs_spill(struct runs *rs, int dfd, struct listing *l, unsigned int flags);
+void runs_start(struct runs *rs);
+bool runs_next(struct runs *rs, struct entry *e, struct einfo *info, char *name);
+void runs_free(struct runs *rs);
+
+// binary snapshots (snapshot.c)
+void snap_create(const char *path);
+uint32_t snap_root(const char *name);
+uint32_t snap_last_root(void);
+uint32_t snap_dir(uint32_t dir, const struct listing *l, const struct einfo *info);
+void snap_error(uint32_t dir, int oerr, int rerr);
+void snap_finish(void);
+int snap_load(const char *path);
+unsigned int snap_nroots(void);
+const char *snap_root_name(unsigned int i);
+void processSnapshot(unsigned int root, struct prefix *pfx, struct summary *stats, unsigned int flags);
+int snap_diff(const char *oldpath, const char *newpath);
+void snap_dirstat(uint32_t dir, const struct statx *stx);
+int since_load(const char *path);
+void since_root(const char *name);
+uint32_t since_last_root(void);
+uint32_t since_child(uint32_t dir, const char *name);
+bool since_unchanged(uint32_t dir, const struct statx *stx);
+void since_listing(uint32_t dir, struct listing *l);
+void since_info(uint32_t dir, struct einfo *info);
+
+// --exclude and --prune patterns (match.c)
+void exclude_add(const char *glob);
+void prune_add(const char *glob);
+bool is_excluded(const char *name, size_t len);
+bool is_pruned(const char *name, size_t len);
+
+// watch mode (watch.c)
+int watch_run(const char **dirs, int ndir, const char *sockpath, unsigned int flags);
+
+// batched metadata retrieval (uring.c)
+int uring_stat_listing(int dfd, const struct listing *l, struct einfo *info, unsigned int mask);
+void uring_release(void);
+
+#endif // DIRTREE_H
@@ -0,0 +1,397 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                     Fall 2024
+//
+/// @file
+/// @brief external sort of directory listings that exceed the memory budget (--mem-limit)
+/// @author <Jeon minseo>
+/// @studid <2019-19932>
+///
+/// Whenever the listing being read grows beyond the budget, it is sorted, stat()ed and written
+/// to an unlinked temporary file as one sorted run, and reading continues with an empty
+/// listing. Once the directory is read, the runs are merged with a binary heap keyed like
+/// dirent_compare() while the entries are printed, so only one buffered window per run is held
+/// in memory. If there are more runs than windows of RUN_RBUF_MIN bytes fit into half of the
+/// budget, groups of runs are first merged into longer runs in the same file (cascade), pass by
+/// pass, until they do.
+//--------------------------------------------------------------------------------------------------
+
+#include "dirtree.h"
+
+#define RUN_WBUF (64*1024)    ///< size of the write buffer
+#define RUN_RBUF_MIN 4096     ///< minimum size of the read buffer of a run
+
+/// @brief header of a spilled entry; followed by the namelen bytes of the name and a null byte
+struct spillrec {
+  struct einfo info;          ///< metadata
+  uint64_t ino;               ///< inode number
+  uint16_t namelen;           ///< length of the name
+  uint8_t  type;              ///< file type (DT_*)
+};
+
+/// @brief sorted run in the temporary file
+struct extent {
+  off_t  off;                 ///< file offset of the first record
+  off_t  end;                 ///< file offset of the end of the run
+};
+
+/// @brief run being merged and its current (smallest unmerged) entry
+struct run {
+  off_t  off;                 ///< file offset of the first byte not yet buffered
+  off_t  end;                 ///< file offset of the end of the run
+  char   *buf;                ///< read buffer
+  size_t pos;                 ///< offset of the next record in buf
+  size_t len;                 ///< number of valid bytes in buf
+  struct entry e;             ///< current entry
+  struct einfo info;          ///< metadata of the current entry
+  const char *name;           ///< null-terminated name of the current entry (in buf)
+};
+
+/// @brief spilled runs of a directory and the merge over them
+struct runs {
+  int    fd;                  ///< temporary file (unlinked)
+  off_t  size;                ///< bytes written to the file
+  char   *wbuf;               ///< write buffer (while spilling and cascading)
+  size_t wlen;                ///< number of bytes in wbuf
+  size_t wcap;                ///< capacity of wbuf
+  struct extent *ext;         ///< runs
+  size_t n;                   ///< number of runs
+  size_t cap;                 ///< capacity of ext
+  struct run *run;            ///< runs being merged
+  size_t nrun;                ///< number of runs being merged
+  size_t bufsize;             ///< size of the read buffer of each run being merged
+  uint32_t *heap;             ///< indices of the runs that still have entries, smallest on top
+  size_t hn;                  ///< number of runs in the heap
+};
+
+
+/// @brief open an unlinked temporary file in $TMPDIR (default /tmp)
+///
+/// @retval file descriptor
+static int tmpfile_open(void)
+{
+  const char *dir = getenv("TMPDIR");
+  if ((dir == NULL) || (*dir == '\0')) dir = "/tmp";
+
+  int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd >= 0) return fd;
+
+  // file systems without O_TMPFILE: create and unlink right away
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/dirtree.XXXXXX", dir) >= (int)sizeof(path)) {
+    panic("Temporary directory path too long.");
+  }
+  fd = mkostemp(path, O_CLOEXEC);
+  if (fd < 0) panic("Cannot create temporary file.");
+  unlink(path);
+  return fd;
+}
+
+/// @brief write the buffered bytes to the temporary file
+///
+/// @param rs runs
+static void runs_flush(struct runs *rs)
+{
+  size_t pos = 0;
+
+  while (pos < rs->wlen) {
+    ssize_t n = write(rs->fd, rs->wbuf + pos, rs->wlen - pos);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      panic("Cannot write temporary file.");
+    }
+    pos += n;
+  }
+  rs->size += rs->wlen;
+  rs->wlen = 0;
+}
+
+/// @brief append the record of entry @a e to the temporary file
+///
+/// @param rs runs
+/// @param e entry
+/// @param info metadata of the entry
+/// @param name name of the entry (namelen bytes)
+static void runs_write(struct runs *rs, const struct entry *e, const struct einfo *info,
+                       const char *name)
+{
+  struct spillrec h = { .info = *info, .ino = e->ino, .namelen = e->namelen, .type = e->type };
+  size_t len = sizeof(h) + e->namelen + 1;
+
+  if (rs->wlen + len > rs->wcap) runs_flush(rs);
+  memcpy(rs->wbuf + rs->wlen, &h, sizeof(h));
+  memcpy(rs->wbuf + rs->wlen + sizeof(h), name, e->namelen);
+  rs->wbuf[rs->wlen + len - 1] = '\0';
+  rs->wlen += len;
+}
+
+/// @brief sort and stat listing @a l and append it to the temporary file as a new run. The
+///        caller empties the listing afterwards.
+///
+/// @param rs runs; NULL to create them with the first run
+/// @param dfd directory descriptor
+/// @param l listing
+/// @param flags output control flags (F_*)
+/// @retval runs
+struct runs *runs_spill(struct runs *rs, int dfd, struct listing *l, unsigned int flags)
+{
+  if (rs == NULL) {
+    rs = (struct runs*)xmalloc(sizeof(struct runs));
+    memset(rs, 0, sizeof(*rs));
+    rs->fd = tmpfile_open();
+    rs->wbuf = (char*)xmalloc(RUN_WBUF);
+    rs->wcap = RUN_WBUF;
+  }
+  if (rs->n == rs->cap) {
+    rs->cap = rs->cap ? 2*rs->cap : 16;
+    rs->ext = (struct extent*)xrealloc(rs->ext, rs->cap * sizeof(struct extent));
+  }
+
+  listing_sort(l);
+  struct arena_mark mark = arena_mark(&ent_arena);
+  struct einfo *info = (struct einfo*)arena_alloc(&ent_arena, l->num * sizeof(struct einfo));
+  stat_listing(dfd, l, info, flags);
+
+  struct extent *x = &rs->ext[rs->n++];
+  x->off = rs->size + rs->wlen;
+  for (size_t i = 0; i < l->num; i++) {
+    runs_write(rs, &l->ents[i], &info[i], l->names + l->ents[i].name);
+  }
+  x->end = rs->size + rs->wlen;
+  counters.spills++;
+
+  arena_release(&ent_arena, mark);
+  return rs;
+}
+
+/// @brief make at least @a need bytes of run @a r available in its buffer
+///
+/// @param rs runs
+/// @param r run
+/// @param need number of bytes
+/// @retval true on success
+/// @retval false if the run ends before
+static bool run_fill(struct runs *rs, struct run *r, size_t need)
+{
+  if (r->len - r->pos >= need) return true;
+
+  // keep the partial record, then read as much of the run as fits
+  memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+  r->len -= r->pos;
+  r->pos = 0;
+
+  while ((r->len < need) && (r->off < r->end)) {
+    size_t want = rs->bufsize - r->len;
+    if ((off_t)want > r->end - r->off) want = r->end - r->off;
+    ssize_t n = pread(rs->fd, r->buf + r->len, want, r->off);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      panic("Cannot read temporary file.");
+    }
+    if (n == 0) panic("Temporary file truncated.");
+    r->len += n;
+    r->off += n;
+  }
+
+  return r->len >= need;
+}
+
+/// @brief load the next entry of run @a r
+///
+/// @param rs runs
+/// @param r run
+/// @retval true on success
+/// @retval false if the run is exhausted
+static bool run_load(struct runs *rs, struct run *r)
+{
+  struct spillrec h;
+
+  if (!run_fill(rs, r, sizeof(h))) return false;
+  memcpy(&h, r->buf + r->pos, sizeof(h));
+  if (!run_fill(rs, r, sizeof(h) + h.namelen + 1)) panic("Temporary file truncated.");
+
+  r->name = r->buf + r->pos + sizeof(h);
+  r->pos += sizeof(h) + h.namelen + 1;
+
+  r->info = h.info;
+  r->e.ino = h.ino;
+  r->e.name = 0;
+  r->e.namelen = h.namelen;
+  r->e.type = h.type;
+  return true;
+}
+
+/// @brief order of the current entries of two runs: by name, directories first (see
+///        dirent_compare())
+///
+/// @param a first run
+/// @param b second run
+/// @retval true if the entry of @a a comes before the one of @a b
+static inline bool run_less(const struct run *a, const struct run *b)
+{
+  if ((a->e.type == DT_DIR) != (b->e.type == DT_DIR)) return a->e.type == DT_DIR;
+  return strcmp(a->name, b->name) < 0;
+}
+
+/// @brief restore the heap property below position @a i
+///
+/// @param rs runs
+/// @param i heap position
+static void heap_down(struct runs *rs, size_t i)
+{
+  uint32_t top = rs->heap[i];
+
+  for (;;) {
+    size_t c = 2*i + 1;
+    if (c >= rs->hn) break;
+    if ((c + 1 < rs->hn) && run_less(&rs->run[rs->heap[c+1]], &rs->run[rs->heap[c]])) c++;
+    if (!run_less(&rs->run[rs->heap[c]], &rs->run[top])) break;
+    rs->heap[i] = rs->heap[c];
+    i = c;
+  }
+  rs->heap[i] = top;
+}
+
+/// @brief set up the merge of the runs @a first to @a first + @a num - 1 with read buffers of
+///        rs->bufsize bytes
+///
+/// @param rs runs
+/// @param first index of the first run
+/// @param num number of runs
+static void merge_open(struct runs *rs, size_t first, size_t num)
+{
+  rs->run = (struct run*)xmalloc(num * sizeof(struct run));
+  rs->heap = (uint32_t*)xmalloc(num * sizeof(uint32_t));
+  rs->nrun = num;
+  rs->hn = 0;
+  for (size_t i = 0; i < num; i++) {
+    struct run *r = &rs->run[i];
+    memset(r, 0, sizeof(*r));
+    r->off = rs->ext[first + i].off;
+    r->end = rs->ext[first + i].end;
+    r->buf = (char*)xmalloc(rs->bufsize);
+    if (run_load(rs, r)) rs->heap[rs->hn++] = i;
+  }
+  for (size_t i = rs->hn / 2; i-- > 0; ) heap_down(rs, i);
+}
+
+/// @brief release the read buffers and the heap of the merge
+///
+/// @param rs runs
+static void merge_close(struct runs *rs)
+{
+  for (size_t i = 0; i < rs->nrun; i++) free(rs->run[i].buf);
+  free(rs->run);
+  free(rs->heap);
+  rs->run = NULL;
+  rs->heap = NULL;
+  rs->nrun = rs->hn = 0;
+}
+
+/// @brief move past the smallest entry of the merge (the top of the heap)
+///
+/// @param rs runs
+static void merge_advance(struct runs *rs)
+{
+  if (!run_load(rs, &rs->run[rs->heap[0]])) rs->heap[0] = rs->heap[--rs->hn];
+  if (rs->hn > 0) heap_down(rs, 0);
+}
+
+/// @brief merge the runs @a first to @a first + @a num - 1 into one run appended to the
+///        temporary file; the space of the merged runs is given back to the file system
+///
+/// @param rs runs
+/// @param first index of the first run
+/// @param num number of runs
+/// @retval the merged run
+static struct extent runs_merge(struct runs *rs, size_t first, size_t num)
+{
+  struct extent x = { .off = rs->size + rs->wlen };
+
+  merge_open(rs, first, num);
+  while (rs->hn > 0) {
+    const struct run *r = &rs->run[rs->heap[0]];
+    runs_write(rs, &r->e, &r->info, r->name);
+    merge_advance(rs);
+  }
+  merge_close(rs);
+  runs_flush(rs);
+  x.end = rs->size;
+  counters.spills++;
+
+  for (size_t i = first; i < first + num; i++) {
+    fallocate(rs->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, rs->ext[i].off,
+              rs->ext[i].end - rs->ext[i].off);
+  }
+  return x;
+}
+
+/// @brief finish spilling and set up the merge. The read buffers of the runs and their state
+///        take about half of the memory budget. If that does not leave RUN_RBUF_MIN bytes per
+///        run, groups of runs are merged into one first (the write buffer then takes the place
+///        of one run), until it does.
+///
+/// @param rs runs
+void runs_start(struct runs *rs)
+{
+  size_t budget = mem_limit / 2;
+  size_t state = sizeof(struct run) + sizeof(uint32_t);
+  size_t fanin = budget / (RUN_RBUF_MIN + state);
+  if (fanin < 2) fanin = 2;
+
+  runs_flush(rs);
+  while (rs->n > fanin) {
+    size_t group = (fanin > 2) ? fanin - 1 : 2;
+    size_t share = budget / (group + 1);
+    rs->bufsize = (share > RUN_RBUF_MIN + state) ? share - state : RUN_RBUF_MIN;
+    rs->wcap = rs->bufsize;
+    rs->wbuf = (char*)xrealloc(rs->wbuf, rs->wcap);
+
+    // the merged runs replace the groups in place; a last group of one is just moved
+    size_t m = 0;
+    for (size_t i = 0; i < rs->n; i += group) {
+      size_t num = (rs->n - i < group) ? rs->n - i : group;
+      rs->ext[m++] = (num > 1) ? runs_merge(rs, i, num) : rs->ext[i];
+    }
+    rs->n = m;
+  }
+  free(rs->wbuf);
+  rs->wbuf = NULL;
+
+  // only a budget too small for two runs leaves less than RUN_RBUF_MIN per run
+  size_t share = budget / rs->n;
+  rs->bufsize = (share > RUN_RBUF_MIN + state) ? share - state : RUN_RBUF_MIN;
+  merge_open(rs, 0, rs->n);
+}
+
+/// @brief next entry of the merge
+///
+/// @param rs runs
+/// @param e entry (output); its name is at offset 0 of @a name
+/// @param info metadata of the entry (output)
+/// @param name name of the entry (output, NAME_MAX+1 bytes)
+/// @retval true on success
+/// @retval false if all runs are exhausted
+bool runs_next(struct runs *rs, struct entry *e, struct einfo *info, char *name)
+{
+  if (rs->hn == 0) return false;
+
+  const struct run *r = &rs->run[rs->heap[0]];
+  *e = r->e;
+  *info = r->info;
+  memcpy(name, r->name, r->e.namelen + 1);
+
+  merge_advance(rs);
+  return true;
+}
+
+/// @brief release the runs and close (and thereby delete) the temporary file
+///
+/// @param rs runs
+void runs_free(struct runs *rs)
+{
+  merge_close(rs);
+  free(rs->ext);
+  free(rs->wbuf);
+  close(rs->fd);
+  free(rs);
+}
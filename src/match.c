@@ -0,0 +1,138 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                     Fall 2024
+//
+/// @file
+/// @brief name patterns of --exclude and --prune
+/// @author <Jeon minseo>
+/// @studid <2019-19932>
+///
+/// Patterns are shell globs (fnmatch(3)) matched against entry names, not paths. They are
+/// classified once when they are added: a pattern without wildcards is compared as a literal,
+/// "*SUFFIX" and "PREFIX*" with a literal rest as a suffix or prefix, so the common patterns
+/// (".git", "node_modules", "*.o", "cache*") cost one length check and one memcmp per name.
+/// Everything else falls back to fnmatch().
+//--------------------------------------------------------------------------------------------------
+
+#include "dirtree.h"
+#include <fnmatch.h>
+
+#define PAT_EXACT   0         ///< name equals the literal
+#define PAT_SUFFIX  1         ///< name ends with the literal ("*SUFFIX")
+#define PAT_PREFIX  2         ///< name starts with the literal ("PREFIX*")
+#define PAT_GLOB    3         ///< anything else: fnmatch()
+
+/// @brief compiled pattern
+struct pattern {
+  const char *glob;           ///< pattern as given
+  const char *lit;            ///< literal part (PAT_EXACT, PAT_SUFFIX, PAT_PREFIX)
+  size_t len;                 ///< length of lit
+  int kind;                   ///< PAT_*
+};
+
+/// @brief list of compiled patterns
+struct matcher {
+  struct pattern *pat;        ///< patterns
+  size_t num;                 ///< number of patterns
+  size_t cap;                 ///< capacity of pat
+};
+
+static struct matcher excludes;       ///< --exclude patterns
+static struct matcher prunes;         ///< --prune patterns
+
+
+/// @brief compile pattern @a glob and add it to matcher @a m
+///
+/// @param m matcher
+/// @param glob pattern (not copied; must stay valid)
+static void matcher_add(struct matcher *m, const char *glob)
+{
+  if (m->num == m->cap) {
+    m->cap = m->cap ? 2*m->cap : 8;
+    m->pat = (struct pattern*)xrealloc(m->pat, m->cap * sizeof(struct pattern));
+  }
+  struct pattern *p = &m->pat[m->num++];
+  size_t len = strlen(glob);
+  size_t wild = strcspn(glob, "*?[\\");
+
+  p->glob = glob;
+  p->lit = glob;
+  p->len = len;
+  if (wild == len) p->kind = PAT_EXACT;
+  else if ((wild == 0) && (len > 1) && (strcspn(glob + 1, "*?[\\") == len - 1)) {
+    p->kind = PAT_SUFFIX;
+    p->lit = glob + 1;
+    p->len = len - 1;
+  }
+  else if ((wild == len - 1) && (glob[wild] == '*')) {
+    p->kind = PAT_PREFIX;
+    p->len = len - 1;
+  }
+  else p->kind = PAT_GLOB;
+}
+
+/// @brief check name @a name against the patterns of matcher @a m
+///
+/// @param m matcher
+/// @param name null-terminated entry name
+/// @param len length of @a name
+/// @retval true if a pattern matches
+static bool matcher_match(const struct matcher *m, const char *name, size_t len)
+{
+  for (size_t i = 0; i < m->num; i++) {
+    const struct pattern *p = &m->pat[i];
+
+    switch (p->kind) {
+      case PAT_EXACT:
+        if ((len == p->len) && !memcmp(name, p->lit, len)) return true;
+        break;
+      case PAT_SUFFIX:
+        // like fnmatch() without FNM_PERIOD: "*" also matches a leading dot
+        if ((len >= p->len) && !memcmp(name + len - p->len, p->lit, p->len)) return true;
+        break;
+      case PAT_PREFIX:
+        if ((len >= p->len) && !memcmp(name, p->lit, p->len)) return true;
+        break;
+      default:
+        if (fnmatch(p->glob, name, 0) == 0) return true;
+    }
+  }
+  return false;
+}
+
+/// @brief add an --exclude pattern
+///
+/// @param glob pattern (not copied; must stay valid)
+void exclude_add(const char *glob)
+{
+  matcher_add(&excludes, glob);
+}
+
+/// @brief add a --prune pattern
+///
+/// @param glob pattern (not copied; must stay valid)
+void prune_add(const char *glob)
+{
+  matcher_add(&prunes, glob);
+}
+
+/// @brief check whether an entry is excluded (--exclude): it is neither listed nor stat()ed,
+///        counted or descended into
+///
+/// @param name null-terminated entry name
+/// @param len length of @a name
+/// @retval true if the entry is excluded
+bool is_excluded(const char *name, size_t len)
+{
+  return matcher_match(&excludes, name, len);
+}
+
+/// @brief check whether a directory is pruned (--prune): it is listed and counted, but not
+///        descended into
+///
+/// @param name null-terminated directory name
+/// @param len length of @a name
+/// @retval true if the directory is pruned
+bool is_pruned(const char *name, size_t len)
+{
+  return matcher_match(&prunes, name, len);
+}
@@ -0,0 +1,610 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                     Fall 2024
+//
+/// @file
+/// @brief parallel directory traversal with a work-stealing thread pool
+/// @author <Jeon minseo>
+/// @studid <2019-19932>
+///
+/// Every directory is a task (struct dnode). A worker opens the directory relative to its
+/// parent's descriptor, reads, sorts and stats all entries and then pushes one task per
+/// subdirectory onto its own deque. Idle workers steal the oldest task of another worker.
+///
+/// A directory keeps its descriptor open until all its subdirectories have been opened, but only
+/// as long as the held descriptors stay within a budget derived from RLIMIT_NOFILE. Beyond that
+/// the descriptor is closed right after the listing has been read, and the subdirectories are
+/// opened through ".." of the worker's last directory (verified by device and inode, like
+/// processDir() does) or by name from the nearest ancestor that kept its descriptor.
+///
+/// The calling thread renders the tree: it walks the nodes in the same sorted, directories-first
+/// order as processDir(), waiting for each node's listing to become available, so the output
+/// is identical to the sequential traversal. The workers stop taking tasks while the listings
+/// read but not yet rendered exceed POOL_READAHEAD entries; the rendering thread then runs the
+/// tasks it waits for itself. Summaries are accumulated per worker and merged once the tree is
+/// done.
+//--------------------------------------------------------------------------------------------------
+
+#include "dirtree.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#define POOL_READAHEAD (1 << 20)  ///< entries read ahead of the rendering thread before the
+                                  ///< workers wait
+#define POOL_MAX_UP    256        ///< levels a worker climbs through ".." to reach a parent
+
+/// @brief directory task and its result
+struct dnode {
+  struct dnode *parent;       ///< parent directory (NULL for the root)
+  struct dnode *base;         ///< node the subdirectories are opened from: the node itself if it
+                              ///< keeps its descriptor, otherwise the parent's base
+  const char *name;           ///< name in the parent's listing (path for the root)
+  unsigned int depth;         ///< level below the root
+  int fd;                     ///< directory descriptor, valid while fdrefs > 0 if base is the node
+  atomic_int fdrefs;          ///< users of fd: the node, children and descendants not yet opened
+  dev_t dev;                  ///< device of the directory if it closed its descriptor early
+  ino_t ino;                  ///< inode of the directory if it closed its descriptor early
+  int err;                    ///< errno if the directory could not be opened
+  int rerr;                   ///< errno if reading the directory failed
+  size_t next;                ///< index of the next entry to render
+  uint32_t snap;              ///< --snapshot: record index of the directory
+  uint32_t snap_first;        ///< --snapshot: record index of its first entry
+  bool done;                  ///< listing complete (protected by pool.lock)
+  struct listing l;           ///< sorted entries
+  struct einfo *info;         ///< metadata of the entries
+  struct dnode **sub;         ///< task of each entry (NULL for non-directories)
+  char *block;                ///< single allocation holding l, info and sub
+};
+
+/// @brief double-ended task queue of a worker. The owner pushes and pops at the bottom (newest
+///        task, depth-first), thieves take from the top (oldest task, largest subtree).
+struct deque {
+  struct dnode **buf;         ///< ring buffer
+  size_t cap;                 ///< capacity of buf
+  size_t head;                ///< index of the oldest task
+  size_t num;                 ///< number of tasks
+  pthread_mutex_t lock;       ///< protects the deque
+};
+
+/// @brief worker thread
+struct worker {
+  pthread_t tid;              ///< thread id
+  unsigned int id;            ///< index in pool.w
+  struct deque dq;            ///< task queue
+  struct summary sum;         ///< statistics of the entries this worker has processed
+  struct counters ctr;        ///< performance counters, copied from the thread on exit
+  int cur_fd;                 ///< last directory opened without being kept (-1 if none)
+  unsigned int cur_depth;     ///< its level below the root
+  dev_t cur_dev;              ///< its device
+  ino_t cur_ino;              ///< its inode
+};
+
+/// @brief thread pool
+static struct {
+  struct worker *w;           ///< workers, followed by the slot of the rendering thread
+  unsigned int n;             ///< number of workers
+  unsigned int flags;         ///< output control flags (F_*)
+  uint32_t xdev;              ///< -x: device of the current root (set before its subdirectories are queued)
+  int fd_budget;              ///< directory descriptors that may be held for subdirectories
+  atomic_int held;            ///< directory descriptors held for subdirectories
+  atomic_long ahead;          ///< entries read and not yet rendered
+  atomic_long queued;         ///< number of tasks in all deques
+  unsigned int idle;          ///< number of workers waiting for work
+  bool quit;                  ///< workers terminate when set
+  pthread_mutex_t lock;       ///< protects idle, quit and dnode.done
+  pthread_cond_t work;        ///< signalled when a task is queued or quit is set
+  pthread_cond_t done;        ///< signalled when a node is done
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+           .done = PTHREAD_COND_INITIALIZER };
+
+static __thread struct worker *self;  ///< worker of the calling thread
+
+
+/// @brief queue task @a n on the deque of worker @a w
+///
+/// @param w worker
+/// @param n task
+static void push(struct worker *w, struct dnode *n)
+{
+  struct deque *dq = &w->dq;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->num == dq->cap) {
+    size_t cap = dq->cap ? 2*dq->cap : 256;
+    struct dnode **buf = (struct dnode**)xmalloc(cap * sizeof(struct dnode*));
+    for (size_t i = 0; i < dq->num; i++) buf[i] = dq->buf[(dq->head + i) % dq->cap];
+    free(dq->buf);
+    dq->buf = buf;
+    dq->cap = cap;
+    dq->head = 0;
+  }
+  dq->buf[(dq->head + dq->num++) % dq->cap] = n;
+  pthread_mutex_unlock(&dq->lock);
+
+  atomic_fetch_add(&pool.queued, 1);
+  pthread_mutex_lock(&pool.lock);
+  if (pool.idle > 0) pthread_cond_signal(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/// @brief take a task from deque @a dq
+///
+/// @param dq deque
+/// @param newest true: take the newest task (owner), false: the oldest task (thief)
+/// @retval task or NULL if the deque is empty
+static struct dnode *take(struct deque *dq, bool newest)
+{
+  struct dnode *n = NULL;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->num > 0) {
+    if (newest) {
+      n = dq->buf[(dq->head + dq->num - 1) % dq->cap];
+    } else {
+      n = dq->buf[dq->head];
+      dq->head = (dq->head + 1) % dq->cap;
+    }
+    dq->num--;
+  }
+  pthread_mutex_unlock(&dq->lock);
+
+  if (n) atomic_fetch_sub(&pool.queued, 1);
+  return n;
+}
+
+/// @brief take one of the descriptors of the budget for the subdirectories of a node
+///
+/// @retval true if the node may keep its descriptor open
+static bool fd_hold(void)
+{
+  int held = atomic_load(&pool.held);
+
+  while (held < pool.fd_budget) {
+    if (atomic_compare_exchange_weak(&pool.held, &held, held + 1)) return true;
+  }
+  return false;
+}
+
+/// @brief drop one reference to the descriptor of node @a n; the last one closes it
+///
+/// @param n node
+static void fd_release(struct dnode *n)
+{
+  if (atomic_fetch_sub(&n->fdrefs, 1) == 1) {
+    close(n->fd);
+    // the root's descriptor is not part of the budget
+    if (n->parent) atomic_fetch_sub(&pool.held, 1);
+  }
+}
+
+/// @brief make @a fd, the directory @a dev/@a ino at level @a depth, the last directory of the
+///        calling thread; the previous one is closed
+///
+/// @param fd directory descriptor
+/// @param depth level below the root
+/// @param dev device
+/// @param ino inode
+static void cursor_set(int fd, unsigned int depth, dev_t dev, ino_t ino)
+{
+  if ((self->cur_fd >= 0) && (self->cur_fd != fd)) close(self->cur_fd);
+  self->cur_fd = fd;
+  self->cur_depth = depth;
+  self->cur_dev = dev;
+  self->cur_ino = ino;
+}
+
+/// @brief reopen node @a p, which closed its descriptor early, through ".." of the last
+///        directory of the calling thread. Usually that is a child or a grandchild of @a p.
+///
+/// @param p node
+/// @retval true if the calling thread's last directory is now @a p
+static bool cursor_up(struct dnode *p)
+{
+  if ((self->cur_fd < 0) || (self->cur_depth < p->depth)) return false;
+
+  unsigned int up = self->cur_depth - p->depth;
+  if (up == 0) return (self->cur_dev == p->dev) && (self->cur_ino == p->ino);
+  if (up > POOL_MAX_UP) return false;
+
+  char path[3*POOL_MAX_UP];
+  for (unsigned int i = 0; i < up; i++) memcpy(path + 3*i, "../", 3);
+  path[3*up - 1] = '\0';
+
+  struct stat st;
+  int fd = openat(self->cur_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return false;
+  counters.opens++;
+  if ((fstat(fd, &st) < 0) || (st.st_dev != p->dev) || (st.st_ino != p->ino)) {
+    // a directory on the way has been moved meanwhile
+    close(fd);
+    return false;
+  }
+  cursor_set(fd, p->depth, p->dev, p->ino);
+  return true;
+}
+
+/// @brief reopen node @a p, which closed its descriptor early, by name from its base, the
+///        nearest ancestor that kept its descriptor
+///
+/// @param p node
+/// @param err errno on failure
+/// @retval true if the calling thread's last directory is now @a p
+static bool cursor_down(struct dnode *p, int *err)
+{
+  struct dnode *base = p->base;
+  unsigned int num = p->depth - base->depth;
+  struct dnode **path = (struct dnode**)xmalloc(num * sizeof(struct dnode*));
+  int fd = base->fd;
+
+  for (struct dnode *a = p; a != base; a = a->parent) path[--num] = a;
+  for (unsigned int i = 0; (i < p->depth - base->depth) && (fd >= 0); i++) {
+    int cfd = openat(fd, path[i]->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (cfd < 0) *err = errno;
+    if (fd != base->fd) close(fd);
+    fd = cfd;
+    if (fd >= 0) counters.opens++;
+  }
+  free(path);
+
+  if (fd < 0) return false;
+  cursor_set(fd, p->depth, p->dev, p->ino);
+  return true;
+}
+
+/// @brief open the directory of node @a n relative to its parent's descriptor. If the parent
+///        has closed it, the parent is reopened first (cursor_up(), cursor_down()).
+///
+/// @param n node with a parent
+/// @retval descriptor or -1 (errno in n->err)
+static int open_node(struct dnode *n)
+{
+  struct dnode *p = n->parent;
+
+  if (p->base == p) return open_subdir(p->fd, n->name, pool.flags, &n->err);
+  if (!cursor_up(p) && !cursor_down(p, &n->err)) return -1;
+  return open_subdir(self->cur_fd, n->name, pool.flags, &n->err);
+}
+
+/// @brief mark node @a n as done and wake up the rendering thread
+///
+/// @param n node
+static void finish(struct dnode *n)
+{
+  pthread_mutex_lock(&pool.lock);
+  n->done = true;
+  pthread_cond_broadcast(&pool.done);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/// @brief create a task for directory @a name in @a parent
+///
+/// @param parent parent node or NULL
+/// @param name name in the parent directory or path
+/// @retval new node
+static struct dnode *dnode_new(struct dnode *parent, const char *name)
+{
+  struct dnode *n = (struct dnode*)xmalloc(sizeof(struct dnode));
+
+  memset(n, 0, sizeof(*n));
+  n->parent = parent;
+  n->name = name;
+  n->depth = parent ? parent->depth + 1 : 0;
+  n->fd = -1;
+  return n;
+}
+
+/// @brief free node @a n after it has been rendered; wakes up the workers if they have been
+///        waiting for the rendering thread to catch up
+///
+/// @param n node
+static void dnode_free(struct dnode *n)
+{
+  long num = n->l.num + 1;
+  long ahead = atomic_fetch_sub(&pool.ahead, num);
+
+  if ((ahead >= POOL_READAHEAD) && (ahead - num < POOL_READAHEAD)) {
+    pthread_mutex_lock(&pool.lock);
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+  }
+  free(n->block);
+  free(n);
+}
+
+/// @brief process task @a n: open, read, sort and stat the directory and queue its subdirectories
+///
+/// @param n node
+static void run(struct dnode *n)
+{
+  // open the directory relative to the parent's descriptor. The reference to the base is
+  // dropped only once the subdirectories have taken theirs.
+  struct dnode *base = n->parent ? n->parent->base : NULL;
+  if (n->parent) {
+    n->fd = open_node(n);
+  } else {
+    n->fd = open(n->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (n->fd < 0) n->err = errno;
+    else if (pool.flags & F_XDEV) pool.xdev = fd_device(n->fd);
+  }
+  if (n->fd < 0) {
+    if (base) fd_release(base);
+    atomic_fetch_add(&pool.ahead, 1);
+    finish(n);
+    return;
+  }
+  counters.opens++;
+
+  // read the listing into the thread's arenas and move it into a single block owned by the node
+  struct arena_mark ent_mark = arena_mark(&ent_arena);
+  struct arena_mark str_mark = arena_mark(&str_arena);
+  struct listing tmp = { 0 };
+  n->rerr = read_listing(n->fd, &tmp, NULL, pool.flags);
+  self->sum.excluded += tmp.excluded;
+
+  size_t num = tmp.num;
+  size_t esize = num * sizeof(struct entry);
+  size_t isize = num * sizeof(struct einfo);
+  size_t ssize = num * sizeof(struct dnode*);
+  n->block = (char*)xmalloc(esize + isize + ssize + tmp.nlen);
+  n->l.ents = (struct entry*)n->block;
+  n->info = (struct einfo*)(n->block + esize);
+  n->sub = (struct dnode**)(n->block + esize + isize);
+  n->l.names = n->block + esize + isize + ssize;
+  n->l.num = n->l.cap = num;
+  n->l.nlen = n->l.ncap = tmp.nlen;
+  if (num > 0) {
+    memcpy(n->l.ents, tmp.ents, esize);
+    memcpy(n->l.names, tmp.names, tmp.nlen);
+  }
+  arena_release(&ent_arena, ent_mark);
+  arena_release(&str_arena, str_mark);
+  atomic_fetch_add(&pool.ahead, num + 1);
+
+  stat_listing(n->fd, &n->l, n->info, pool.flags);
+
+  // statistics and subdirectory tasks (-x: not for mount points; not for pruned directories)
+  int nsub = 0;
+  for (size_t i = 0; i < num; i++) {
+    n->sub[i] = NULL;
+    if (n->info[i].err) continue;
+    update_stats(&self->sum, &n->info[i], pool.flags);
+    if (!S_ISDIR(n->info[i].mode)) continue;
+    const char *name = n->l.names + n->l.ents[i].name;
+    if ((pool.flags & F_XDEV) && crosses_device(n->fd, name, &n->info[i], pool.xdev)) continue;
+    if ((pool.flags & F_PRUNE) && is_pruned(name, n->l.ents[i].namelen)) {
+      self->sum.pruned++;
+      continue;
+    }
+    n->sub[i] = dnode_new(n, name);
+    nsub++;
+  }
+
+  // the descriptor stays open until all subdirectories have been opened, if the budget allows
+  // (always for the root). Otherwise they are opened from the base, which they keep open.
+  if ((nsub > 0) && (!base || fd_hold())) {
+    n->base = n;
+    atomic_store(&n->fdrefs, 1 + nsub);
+  } else if (nsub > 0) {
+    // the descriptor becomes the worker's last directory, usually the first subdirectory's parent
+    struct stat st;
+    if (fstat(n->fd, &st) < 0) panic("fstat failed.");
+    n->base = base;
+    n->dev = st.st_dev;
+    n->ino = st.st_ino;
+    atomic_fetch_add(&base->fdrefs, nsub);
+    cursor_set(n->fd, n->depth, n->dev, n->ino);
+    n->fd = -1;
+  } else {
+    close(n->fd);
+    n->fd = -1;
+  }
+  for (size_t i = num; i-- > 0; ) {
+    // pushed in reverse so that the first subdirectory is popped first
+    if (n->sub[i]) push(self, n->sub[i]);
+  }
+  if (n->base == n) fd_release(n);
+  if (base) fd_release(base);
+
+  finish(n);
+}
+
+/// @brief worker thread main loop
+///
+/// @param arg worker
+/// @retval NULL
+static void *worker_main(void *arg)
+{
+  self = (struct worker*)arg;
+
+  for (;;) {
+    // own tasks first (newest), then steal the oldest task of another worker or of the
+    // rendering thread. None while the rendering thread lags too far behind.
+    struct dnode *n = NULL;
+    if (atomic_load(&pool.ahead) < POOL_READAHEAD) {
+      n = take(&self->dq, true);
+      for (unsigned int i = 1; (n == NULL) && (i <= pool.n); i++) {
+        n = take(&pool.w[(self->id + i) % (pool.n + 1)].dq, false);
+      }
+    }
+
+    if (n) {
+      run(n);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    while (((atomic_load(&pool.queued) == 0) || (atomic_load(&pool.ahead) >= POOL_READAHEAD)) &&
+           !pool.quit) {
+      pool.idle++;
+      pthread_cond_wait(&pool.work, &pool.lock);
+      pool.idle--;
+    }
+    bool quit = pool.quit && (atomic_load(&pool.queued) == 0);
+    pthread_mutex_unlock(&pool.lock);
+    if (quit) break;
+  }
+
+  uring_release();
+  self->ctr = counters;
+  return NULL;
+}
+
+/// @brief start the thread pool
+///
+/// @param nthreads number of worker threads
+/// @param flags output control flags (F_*)
+void pool_start(unsigned int nthreads, unsigned int flags)
+{
+  // directories with unopened subdirectories keep their descriptor open; allow as many as we may
+  // and budget what is left after the reserve and a directory, a reopened parent and an io_uring
+  // per thread
+  struct rlimit rl;
+  if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur < rl.rlim_max)) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  rlim_t avail = FD_RESERVE + 3*(nthreads + 1);
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0) rl.rlim_cur = MAX_OPEN_DIRS + avail;
+  avail = (rl.rlim_cur > avail) ? rl.rlim_cur - avail : 0;
+  pool.fd_budget = (avail < INT_MAX) ? (int)avail : INT_MAX;
+
+  pool.n = nthreads;
+  pool.flags = flags;
+  pool.w = (struct worker*)xmalloc((nthreads + 1) * sizeof(struct worker));
+  memset(pool.w, 0, (nthreads + 1) * sizeof(struct worker));
+
+  for (unsigned int i = 0; i <= nthreads; i++) {
+    pool.w[i].id = i;
+    pool.w[i].cur_fd = -1;
+    pthread_mutex_init(&pool.w[i].dq.lock, NULL);
+  }
+  for (unsigned int i = 0; i < nthreads; i++) {
+    if (pthread_create(&pool.w[i].tid, NULL, worker_main, &pool.w[i]) != 0) {
+      panic("Cannot create thread.");
+    }
+  }
+}
+
+/// @brief stop the thread pool and add the workers' performance counters to the caller's
+void pool_stop(void)
+{
+  pthread_mutex_lock(&pool.lock);
+  pool.quit = true;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (unsigned int i = 0; i <= pool.n; i++) {
+    if (i < pool.n) {
+      pthread_join(pool.w[i].tid, NULL);
+      counters_merge(&counters, &pool.w[i].ctr);
+    }
+    if (pool.w[i].cur_fd >= 0) close(pool.w[i].cur_fd);
+    free(pool.w[i].dq.buf);
+    pthread_mutex_destroy(&pool.w[i].dq.lock);
+  }
+  free(pool.w);
+  pool.w = NULL;
+  pool.n = 0;
+}
+
+/// @brief take a task for the rendering thread: the newest of its own deque or of a worker's,
+///        which is where the next node to render usually is
+///
+/// @retval task or NULL if all deques are empty
+static struct dnode *take_newest(void)
+{
+  struct dnode *n = NULL;
+
+  for (unsigned int i = 0; (n == NULL) && (i <= pool.n); i++) {
+    n = take(&pool.w[(pool.n + i) % (pool.n + 1)].dq, true);
+  }
+  return n;
+}
+
+/// @brief wait until node @a n is done and report its errors. While the workers wait for the
+///        rendering thread to catch up, the queued tasks are run on the calling thread.
+///
+/// @param n node
+/// @param pfx prefix stack
+/// @param flags output control flags (F_*)
+static void render_enter(struct dnode *n, struct prefix *pfx, unsigned int flags)
+{
+  pthread_mutex_lock(&pool.lock);
+  while (!n->done) {
+    struct dnode *t = NULL;
+    if (atomic_load(&pool.ahead) >= POOL_READAHEAD) {
+      pthread_mutex_unlock(&pool.lock);
+      if ((t = take_newest()) != NULL) run(t);
+      pthread_mutex_lock(&pool.lock);
+    }
+    if (!t && !n->done) pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+  if (n->err) print_errno(pfx, n->err, flags);
+  else if (n->rerr) print_read_error(n->rerr);
+
+  if (flags & F_SNAPSHOT) {
+    if (n->err || n->rerr) snap_error(n->snap, n->err, n->rerr);
+    if (!n->err) n->snap_first = snap_dir(n->snap, &n->l, n->info);
+  }
+}
+
+/// @brief print the subtree of node @a root in sorted order, waiting for listings as needed.
+///        Frees the nodes of the subtree. Iterative: the parent links of the nodes serve as the
+///        stack, so the depth of the tree is not limited by the thread's stack.
+///
+/// @param root node
+/// @param pfx prefix stack
+/// @param flags output control flags (F_*)
+static void render(struct dnode *root, struct prefix *pfx, unsigned int flags)
+{
+  struct dnode *n = root;
+
+  if (flags & F_SNAPSHOT) n->snap = snap_last_root();
+  render_enter(n, pfx, flags);
+  for (;;) {
+    // node done: free it and return to the parent
+    if (n->err || (n->next == n->l.num)) {
+      struct dnode *parent = (n == root) ? NULL : n->parent;
+      dnode_free(n);
+      if (parent == NULL) break;
+      prefix_pop(pfx);
+      n = parent;
+      continue;
+    }
+
+    size_t i = n->next++;
+    print_entry(pfx, n->l.names + n->l.ents[i].name, n->l.ents[i].namelen, &n->info[i],
+                i == n->l.num - 1, flags);
+
+    if (n->sub[i]) {
+      prefix_push(pfx);
+      n->sub[i]->snap = n->snap_first + i;
+      n = n->sub[i];
+      render_enter(n, pfx, flags);
+    }
+  }
+}
+
+/// @brief process directory @a dn with the thread pool and print its tree. Produces the same
+///        output and statistics as processDir().
+///
+/// @param dn path of the directory
+/// @param pfx prefix stack
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+void processDirParallel(const char *dn, struct prefix *pfx, struct summary *stats, unsigned int flags)
+{
+  struct dnode *root = dnode_new(NULL, dn);
+
+  self = &pool.w[pool.n];
+  push(&pool.w[0], root);
+  render(root, pfx, flags);
+
+  // all nodes are done: merge and reset the per-worker statistics
+  for (unsigned int i = 0; i <= pool.n; i++) {
+    summary_merge(stats, &pool.w[i].sum);
+    memset(&pool.w[i].sum, 0, sizeof(pool.w[i].sum));
+  }
+}
@@ -0,0 +1,862 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                     Fall 2024
+//
+/// @file
+/// @brief binary snapshots of a traversal (--snapshot), rendering them (--from-snapshot),
+///        comparing two of them (--diff) and reusing one for a rescan (--since)
+/// @author <Jeon minseo>
+/// @studid <2019-19932>
+///
+/// File layout (all integers in host byte order, sections 8-byte aligned):
+///
+///   struct snaphdr                  magic, version and the location of the sections
+///   struct snaprec[nrec]            one fixed-width record per entry and per root directory
+///   char strings[str_len]           deduplicated, null-terminated names
+///   uint32_t roots[nroots]          record index of each root directory, in argument order
+///
+/// The children of a directory are consecutive records [first, first + nchild) in printing
+/// order, i.e., the ndir subdirectories and then the other entries, each run sorted by name.
+/// A snapshot can thus be mmap'd and walked, and a child looked up by name, without parsing. Records are appended while
+/// the tree is printed; the child range (and any error) of a directory is patched into its
+/// record when the directory is entered.
+///
+/// Since the children of every directory are sorted, two snapshots are compared by merging the
+/// child ranges of each directory present in both, in one pass over both files and with memory
+/// proportional to the depth of the tree only.
+///
+/// A rescan with --since looks up every directory it enters in the previous snapshot (a binary
+/// search among the children of the parent's record) and, if the directory has not changed,
+/// takes its entries from there instead of reading it.
+//--------------------------------------------------------------------------------------------------
+
+#include "dirtree.h"
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define SNAP_MAGIC   "DTSNAP\0"   ///< file magic (8 bytes with the terminating null byte)
+#define SNAP_VERSION 2            ///< format version
+#define SNAP_WBUF    4096         ///< number of records buffered before writing
+
+/// @brief snapshot file header
+struct snaphdr {
+  char     magic[8];          ///< SNAP_MAGIC
+  uint32_t version;           ///< SNAP_VERSION
+  uint32_t nroots;            ///< number of root directories
+  uint64_t nrec;              ///< number of records
+  uint64_t rec_off;           ///< file offset of the records
+  uint64_t str_off;           ///< file offset of the string table
+  uint64_t str_len;           ///< size of the string table
+  uint64_t root_off;          ///< file offset of the root indices
+};
+
+/// @brief fixed-width record of an entry (72 bytes)
+struct snaprec {
+  uint64_t ino;               ///< inode number
+  int64_t  size;              ///< size in bytes
+  int64_t  blocks;            ///< number of 512 byte blocks
+  int64_t  mtime;             ///< modification time (nanoseconds since the epoch)
+  int64_t  ctime;             ///< status change time (nanoseconds since the epoch)
+  uint32_t name;              ///< offset of the name in the string table
+  uint32_t mode;              ///< file type and mode
+  uint32_t uid;               ///< user id
+  uint32_t gid;               ///< group id
+  uint32_t first;             ///< directories: record index of the first child
+  uint32_t nchild;            ///< directories: number of children
+  uint32_t ndir;              ///< directories: number of children in the leading run of
+                              ///< subdirectories (the rest is a second run sorted by name)
+  uint16_t err;               ///< errno if the metadata could not be retrieved
+  uint8_t  oerr;              ///< directories: errno if the directory could not be opened
+  uint8_t  rerr;              ///< directories: errno if reading the directory failed
+};
+
+/// @brief snapshot being written
+struct snapwriter {
+  int      fd;                ///< snapshot file
+  struct snaprec *buf;        ///< records not yet written
+  uint32_t nbuf;              ///< number of records in buf
+  uint32_t nrec;              ///< number of records (written and buffered)
+  char     *str;              ///< string table
+  size_t   slen;              ///< size of the string table
+  size_t   scap;              ///< capacity of str
+  uint32_t *hash;             ///< open-addressing set of string offsets (SNAP_NONE: empty)
+  size_t   hcap;              ///< number of slots (power of two)
+  size_t   hnum;              ///< number of used slots
+  uint32_t roots[MAX_DIR];    ///< record index of each root directory
+  uint32_t nroots;            ///< number of root directories
+};
+
+/// @brief snapshot being read (mapped)
+struct snapreader {
+  const struct snaphdr *hdr;  ///< header
+  const struct snaprec *rec;  ///< records
+  const char *str;            ///< string table
+  const uint32_t *roots;      ///< root indices
+};
+
+static struct snapwriter w;   ///< --snapshot output
+static struct snapreader r;   ///< --from-snapshot input
+static struct snapreader prev;  ///< --since input
+static uint32_t prev_root;    ///< --since: record of the root directory being traversed
+
+
+/// @brief round @a n up to a multiple of 8
+static inline uint64_t align8(uint64_t n)
+{
+  return (n + 7) & ~(uint64_t)7;
+}
+
+/// @brief write @a len bytes at file offset @a off of the snapshot, panic on failure
+static void snap_pwrite(const void *p, size_t len, uint64_t off)
+{
+  while (len > 0) {
+    ssize_t n = pwrite(w.fd, p, len, off);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      panic("Cannot write snapshot.");
+    }
+    p = (const char*)p + n;
+    len -= n;
+    off += n;
+  }
+}
+
+/// @brief offset of the name @a name in the string table; added if not present yet
+///
+/// @param name null-terminated name
+/// @param len length of the name
+/// @retval offset
+static uint32_t strtab_add(const char *name, size_t len)
+{
+  // FNV-1a
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 1099511628211ULL;
+
+  size_t i = h & (w.hcap - 1);
+  while (w.hash[i] != SNAP_NONE) {
+    const char *s = w.str + w.hash[i];
+    if ((strncmp(s, name, len) == 0) && (s[len] == '\0')) return w.hash[i];
+    i = (i + 1) & (w.hcap - 1);
+  }
+
+  // new name: append it and keep the set at most half full
+  if (w.slen + len + 1 > UINT32_MAX) panic("Snapshot string table too large.");
+  if (w.slen + len + 1 > w.scap) {
+    w.scap = 2*(w.slen + len + 1);
+    w.str = (char*)xrealloc(w.str, w.scap);
+  }
+  uint32_t off = w.slen;
+  memcpy(w.str + off, name, len);
+  w.str[off + len] = '\0';
+  w.slen += len + 1;
+  w.hash[i] = off;
+
+  if (++w.hnum > w.hcap / 2) {
+    uint32_t *old = w.hash;
+    size_t ocap = w.hcap;
+    w.hcap *= 2;
+    w.hash = (uint32_t*)xmalloc(w.hcap * sizeof(uint32_t));
+    memset(w.hash, 0xff, w.hcap * sizeof(uint32_t));
+    for (size_t j = 0; j < ocap; j++) {
+      if (old[j] == SNAP_NONE) continue;
+      const char *s = w.str + old[j];
+      uint64_t g = 14695981039346656037ULL;
+      for (; *s; s++) g = (g ^ (unsigned char)*s) * 1099511628211ULL;
+      size_t k = g & (w.hcap - 1);
+      while (w.hash[k] != SNAP_NONE) k = (k + 1) & (w.hcap - 1);
+      w.hash[k] = old[j];
+    }
+    free(old);
+  }
+
+  return off;
+}
+
+/// @brief write the buffered records
+static void rec_flush(void)
+{
+  uint64_t off = sizeof(struct snaphdr) + (uint64_t)(w.nrec - w.nbuf) * sizeof(struct snaprec);
+  snap_pwrite(w.buf, w.nbuf * sizeof(struct snaprec), off);
+  w.nbuf = 0;
+}
+
+/// @brief append a record
+///
+/// @param rec record
+/// @retval index of the record
+static uint32_t rec_append(const struct snaprec *rec)
+{
+  if (w.nrec == SNAP_NONE) panic("Too many entries for a snapshot.");
+  if (w.nbuf == SNAP_WBUF) rec_flush();
+  w.buf[w.nbuf++] = *rec;
+  return w.nrec++;
+}
+
+/// @brief overwrite @a len bytes at offset @a field of record @a idx, in the buffer or the file
+///
+/// @param idx record index
+/// @param field offset of the field in struct snaprec
+/// @param p new value
+/// @param len size of the field
+static void rec_patch(uint32_t idx, size_t field, const void *p, size_t len)
+{
+  uint32_t flushed = w.nrec - w.nbuf;
+
+  if (idx >= flushed) memcpy((char*)&w.buf[idx - flushed] + field, p, len);
+  else snap_pwrite(p, len, sizeof(struct snaphdr) + (uint64_t)idx * sizeof(struct snaprec) + field);
+}
+
+/// @brief start writing a snapshot to @a path
+///
+/// @param path snapshot file
+void snap_create(const char *path)
+{
+  memset(&w, 0, sizeof(w));
+  w.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (w.fd < 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  w.buf = (struct snaprec*)xmalloc(SNAP_WBUF * sizeof(struct snaprec));
+  w.hcap = 1024;
+  w.hash = (uint32_t*)xmalloc(w.hcap * sizeof(uint32_t));
+  memset(w.hash, 0xff, w.hcap * sizeof(uint32_t));
+}
+
+/// @brief add the record of root directory @a name
+///
+/// @param name directory as given on the command line
+/// @retval record index
+uint32_t snap_root(const char *name)
+{
+  struct snaprec rec = { .name = strtab_add(name, strlen(name)), .mode = S_IFDIR };
+  struct statx stx;
+
+  // identify the directory for --since (the other directories get this from their parent)
+  if (statx(AT_FDCWD, name, 0, STATX_TYPE | STATX_INO | STATX_MTIME | STATX_CTIME, &stx) == 0) {
+    rec.ino = stx.stx_ino;
+    rec.mtime = statx_ns(&stx.stx_mtime);
+    rec.ctime = statx_ns(&stx.stx_ctime);
+  }
+
+  w.roots[w.nroots] = rec_append(&rec);
+  return w.roots[w.nroots++];
+}
+
+/// @brief record index of the root directory added last
+uint32_t snap_last_root(void)
+{
+  return w.roots[w.nroots - 1];
+}
+
+/// @brief add the records of the entries of directory @a dir
+///
+/// @param dir record index of the directory
+/// @param l sorted listing of the directory
+/// @param info metadata of the entries
+/// @retval record index of the first entry; entry i has index first + i
+uint32_t snap_dir(uint32_t dir, const struct listing *l, const struct einfo *info)
+{
+  uint32_t first = w.nrec;
+  uint32_t ndir = 0;
+
+  for (size_t i = 0; i < l->num; i++) {
+    const struct entry *e = &l->ents[i];
+    struct snaprec rec = {
+      .ino = e->ino, .size = info[i].size, .blocks = info[i].blocks, .mtime = info[i].mtime,
+      .ctime = info[i].ctime, .name = strtab_add(l->names + e->name, e->namelen),
+      .mode = info[i].mode, .uid = info[i].uid, .gid = info[i].gid, .err = info[i].err,
+    };
+    rec_append(&rec);
+    if ((e->type == DT_DIR) && (ndir == i)) ndir++;
+  }
+
+  // first, nchild and ndir are adjacent
+  uint32_t range[3] = { first, (uint32_t)l->num, ndir };
+  rec_patch(dir, offsetof(struct snaprec, first), range, sizeof(range));
+  return first;
+}
+
+/// @brief record that directory @a dir could not be opened (@a oerr) or read (@a rerr)
+///
+/// @param dir record index of the directory
+/// @param oerr errno of open or 0
+/// @param rerr errno of read or 0
+void snap_error(uint32_t dir, int oerr, int rerr)
+{
+  uint8_t err[2] = { (uint8_t)oerr, (uint8_t)rerr };
+  rec_patch(dir, offsetof(struct snaprec, oerr), err, sizeof(err));
+}
+
+/// @brief update the identity and times of directory @a dir from @a stx. --since with
+///        --trust-dir-mtime copies the metadata of the entries of unchanged directories from the
+///        previous snapshot, so this keeps the records of their subdirectories current.
+///
+/// @param dir record index of the directory
+/// @param stx statx result with at least STATX_INO, STATX_MTIME and STATX_CTIME
+void snap_dirstat(uint32_t dir, const struct statx *stx)
+{
+  int64_t times[2] = { statx_ns(&stx->stx_mtime), statx_ns(&stx->stx_ctime) };
+
+  rec_patch(dir, offsetof(struct snaprec, ino), &stx->stx_ino, sizeof(uint64_t));
+  rec_patch(dir, offsetof(struct snaprec, mtime), times, sizeof(times));
+}
+
+/// @brief write the string table, the roots and the header and close the snapshot
+void snap_finish(void)
+{
+  rec_flush();
+
+  struct snaphdr hdr = { .magic = SNAP_MAGIC, .version = SNAP_VERSION, .nroots = w.nroots,
+                         .nrec = w.nrec, .rec_off = sizeof(struct snaphdr) };
+  hdr.str_off = hdr.rec_off + (uint64_t)w.nrec * sizeof(struct snaprec);
+  hdr.str_len = w.slen;
+  hdr.root_off = align8(hdr.str_off + w.slen);
+
+  snap_pwrite(w.str, w.slen, hdr.str_off);
+  snap_pwrite(w.roots, w.nroots * sizeof(uint32_t), hdr.root_off);
+  snap_pwrite(&hdr, sizeof(hdr), 0);
+  if (close(w.fd) < 0) panic("Cannot write snapshot.");
+
+  free(w.buf);
+  free(w.str);
+  free(w.hash);
+}
+
+/// @brief map the snapshot @a path and check its consistency
+///
+/// @param path snapshot file
+/// @param s reader (output)
+/// @retval 0 on success
+/// @retval -1 on error (errno set; EINVAL if the file is not a valid snapshot)
+static int snap_map(const char *path, struct snapreader *s)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(struct snaphdr)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  const char *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return -1;
+
+  const struct snaphdr *h = (const struct snaphdr*)p;
+  bool ok = (memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) == 0) && (h->version == SNAP_VERSION) &&
+            (h->nroots <= MAX_DIR) && (h->nrec < SNAP_NONE) &&
+            (h->rec_off == sizeof(struct snaphdr)) &&
+            (h->str_off == h->rec_off + h->nrec * sizeof(struct snaprec)) &&
+            (h->str_len <= size) && (h->str_off <= size - h->str_len) &&
+            ((h->str_len == 0) || (p[h->str_off + h->str_len - 1] == '\0')) &&
+            (h->root_off == align8(h->str_off + h->str_len)) &&
+            (h->root_off + h->nroots * sizeof(uint32_t) <= size);
+
+  s->hdr = h;
+  s->rec = (const struct snaprec*)(p + h->rec_off);
+  s->str = p + h->str_off;
+  s->roots = (const uint32_t*)(p + h->root_off);
+
+  // every index must stay within the file and children must follow their parent (no cycles):
+  // the renderer then needs no checks
+  for (uint64_t i = 0; ok && (i < h->nrec); i++) {
+    const struct snaprec *rec = &s->rec[i];
+    ok = (rec->name < h->str_len) && (rec->first <= h->nrec) && (rec->nchild <= h->nrec - rec->first) &&
+         (rec->ndir <= rec->nchild) && ((rec->nchild == 0) || (rec->first > i));
+  }
+  for (uint32_t i = 0; ok && (i < h->nroots); i++) ok = (s->roots[i] < h->nrec);
+
+  if (!ok) {
+    munmap((void*)p, size);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+/// @brief map the snapshot @a path for rendering
+///
+/// @param path snapshot file
+/// @retval 0 on success
+/// @retval -1 on error (errno set; EINVAL if the file is not a valid snapshot)
+int snap_load(const char *path)
+{
+  return snap_map(path, &r);
+}
+
+/// @brief number of root directories of the loaded snapshot
+unsigned int snap_nroots(void)
+{
+  return r.hdr->nroots;
+}
+
+/// @brief name of root directory @a i of the loaded snapshot
+const char *snap_root_name(unsigned int i)
+{
+  return r.str + r.rec[r.roots[i]].name;
+}
+
+/// @brief print the tree of root directory @a root of the loaded snapshot exactly as
+///        processDir() printed it when the snapshot was taken
+///
+/// @param root root directory (index into the roots)
+/// @param pfx prefix stack
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+void processSnapshot(unsigned int root, struct prefix *pfx, struct summary *stats, unsigned int flags)
+{
+  // record index and next child of every directory on the current path
+  struct { uint32_t dir, next; } *stack = NULL;
+  size_t depth = 0, cap = 0;
+
+  uint32_t dir = r.roots[root];
+  if (r.rec[dir].oerr) {
+    print_errno(pfx, r.rec[dir].oerr, flags);
+    return;
+  }
+
+  for (;;) {
+    // enter dir
+    if (depth == cap) {
+      cap = cap ? 2*cap : 64;
+      stack = xrealloc(stack, cap * sizeof(*stack));
+    }
+    stack[depth].dir = dir;
+    stack[depth++].next = 0;
+    if (r.rec[dir].rerr) print_read_error(r.rec[dir].rerr);
+
+    // print entries until a directory to descend into is found
+    dir = SNAP_NONE;
+    while ((dir == SNAP_NONE) && (depth > 0)) {
+      const struct snaprec *d = &r.rec[stack[depth - 1].dir];
+      if (stack[depth - 1].next == d->nchild) {
+        if (--depth > 0) prefix_pop(pfx);
+        continue;
+      }
+
+      uint32_t i = stack[depth - 1].next++;
+      uint32_t c = d->first + i;
+      const struct snaprec *e = &r.rec[c];
+      const char *name = r.str + e->name;
+      struct einfo info = { .size = e->size, .blocks = e->blocks, .mtime = e->mtime, .mode = e->mode,
+                            .uid = e->uid, .gid = e->gid, .err = e->err };
+
+      print_entry(pfx, name, strlen(name), &info, i == d->nchild - 1, flags);
+      if (info.err) continue;
+      update_stats(stats, &info, flags);
+
+      if (S_ISDIR(info.mode)) {
+        prefix_push(pfx);
+        if (e->oerr) {
+          print_errno(pfx, e->oerr, flags);
+          prefix_pop(pfx);
+        }
+        else dir = c;
+      }
+    }
+    if (dir == SNAP_NONE) break;
+  }
+
+  free(stack);
+}
+
+
+/// @brief cursor over the children of a directory in name order, merging its two runs on the fly
+struct snapcursor {
+  uint32_t a, aend;           ///< next child and end of the first run
+  uint32_t b, bend;           ///< next child and end of the second run
+};
+
+/// @brief directory on the current path of the diff walk
+struct diffframe {
+  uint32_t o, n;              ///< record of the directory in the old/new snapshot (SNAP_NONE: absent)
+  struct snapcursor oc, nc;   ///< children not yet compared
+  int64_t  osize, nsize;      ///< total size of the entries below the directory (old/new)
+  size_t   plen;              ///< length of its path including the trailing '/'
+  char     what;              ///< line printed when done: 'S' (if the size changed), 'A', 'D' or 0
+};
+
+/// @brief differences found by the diff walk
+struct diffstat {
+  unsigned long long added;   ///< entries only in the new snapshot (subtrees count once)
+  unsigned long long removed; ///< entries only in the old snapshot (subtrees count once)
+  unsigned long long resized; ///< non-directories whose size changed
+  unsigned long long retyped; ///< entries whose file type changed
+  unsigned long long unknown; ///< entries that cannot be compared (errors in either snapshot)
+};
+
+#define DIFF_NOSIZE INT64_MIN   ///< size column of an absent side
+
+
+/// @brief position cursor @a c at the first child of directory @a dir
+///
+/// @param s snapshot
+/// @param dir record index of the directory or SNAP_NONE (no children)
+/// @param c cursor (output)
+static void cursor_init(const struct snapreader *s, uint32_t dir, struct snapcursor *c)
+{
+  memset(c, 0, sizeof(*c));
+  if (dir == SNAP_NONE) return;
+
+  const struct snaprec *d = &s->rec[dir];
+  c->a = d->first;
+  c->aend = c->b = d->first + d->ndir;
+  c->bend = d->first + d->nchild;
+}
+
+/// @brief smallest (by name) child of cursor @a c that has not been consumed yet
+///
+/// @retval record index
+/// @retval SNAP_NONE if all children have been consumed
+static uint32_t cursor_peek(const struct snapreader *s, const struct snapcursor *c)
+{
+  if (c->a == c->aend) return c->b == c->bend ? SNAP_NONE : c->b;
+  if (c->b == c->bend) return c->a;
+  return strcmp(s->str + s->rec[c->a].name, s->str + s->rec[c->b].name) < 0 ? c->a : c->b;
+}
+
+/// @brief consume child @a idx returned by cursor_peek()
+static void cursor_pop(struct snapcursor *c, uint32_t idx)
+{
+  if ((c->a < c->aend) && (idx == c->a)) c->a++;
+  else c->b++;
+}
+
+/// @brief name of the file type of @a mode
+static const char *type_name(uint32_t mode)
+{
+  switch (mode & S_IFMT) {
+    case S_IFREG:  return "file";
+    case S_IFDIR:  return "directory";
+    case S_IFLNK:  return "link";
+    case S_IFIFO:  return "pipe";
+    case S_IFSOCK: return "socket";
+    case S_IFCHR:  return "character device";
+    case S_IFBLK:  return "block device";
+    default:       return "unknown";
+  }
+}
+
+/// @brief print a line of the diff: status, old and new size, size delta and path
+///
+/// @param what status character
+/// @param osize old size or DIFF_NOSIZE
+/// @param nsize new size or DIFF_NOSIZE
+/// @param path path relative to the root
+/// @param note text appended to the path or NULL
+static void diff_line(char what, int64_t osize, int64_t nsize, const char *path, const char *note)
+{
+  char o[24] = "-", n[24] = "-", d[24] = "-";
+
+  if (osize != DIFF_NOSIZE) snprintf(o, sizeof(o), "%lld", (long long)osize);
+  if (nsize != DIFF_NOSIZE) snprintf(n, sizeof(n), "%lld", (long long)nsize);
+  if ((osize != DIFF_NOSIZE) && (nsize != DIFF_NOSIZE)) snprintf(d, sizeof(d), "%+lld", (long long)(nsize - osize));
+  out_printf("%c %15s %15s %16s  %s%s\n", what, o, n, d, path, note ? note : "");
+}
+
+/// @brief print a line for an entry that cannot be compared because of an error. The same
+///        error in both snapshots is not a difference.
+///
+/// @param path path relative to the root
+/// @param oerr errno in the old snapshot or 0
+/// @param nerr errno in the new snapshot or 0
+/// @param st differences (updated)
+static void diff_unknown(const char *path, int oerr, int nerr, struct diffstat *st)
+{
+  char note[128];
+
+  if (oerr == nerr) return;
+  if (oerr) snprintf(note, sizeof(note), " (old: %s)", strerror(oerr));
+  else snprintf(note, sizeof(note), " (new: %s)", strerror(nerr));
+  diff_line('?', DIFF_NOSIZE, DIFF_NOSIZE, path, note);
+  st->unknown++;
+}
+
+/// @brief push the frame of directory @a o / @a n (either may be SNAP_NONE) onto the stack
+static void diff_push(const struct snapreader *os, const struct snapreader *ns, struct diffframe **stack,
+                      size_t *depth, size_t *cap, uint32_t o, uint32_t n, size_t plen, char what)
+{
+  if (*depth == *cap) {
+    *cap = *cap ? 2 * *cap : 64;
+    *stack = (struct diffframe*)xrealloc(*stack, *cap * sizeof(struct diffframe));
+  }
+
+  struct diffframe *f = &(*stack)[(*depth)++];
+  f->o = o;
+  f->n = n;
+  cursor_init(os, o, &f->oc);
+  cursor_init(ns, n, &f->nc);
+  f->osize = f->nsize = 0;
+  f->plen = plen;
+  f->what = what;
+}
+
+/// @brief compare the trees below root directories @a oroot and @a nroot with a merge walk
+///        over the (sorted) children of every directory present in both snapshots
+///
+/// @param os old snapshot
+/// @param ns new snapshot
+/// @param oroot record index of the old root
+/// @param nroot record index of the new root
+/// @param st differences (updated)
+static void diff_tree(const struct snapreader *os, const struct snapreader *ns, uint32_t oroot,
+                      uint32_t nroot, struct diffstat *st)
+{
+  struct diffframe *stack = NULL;
+  size_t depth = 0, cap = 0;
+  size_t pcap = 4096;
+  char *path = (char*)xmalloc(pcap);
+
+  strcpy(path, "./");
+  if (os->rec[oroot].oerr || ns->rec[nroot].oerr) {
+    diff_unknown(path, os->rec[oroot].oerr, ns->rec[nroot].oerr, st);
+    free(path);
+    return;
+  }
+  diff_push(os, ns, &stack, &depth, &cap, oroot, nroot, 2, 'S');
+
+  while (depth > 0) {
+    struct diffframe *f = &stack[depth - 1];
+    uint32_t oc = cursor_peek(os, &f->oc);
+    uint32_t nc = cursor_peek(ns, &f->nc);
+
+    if ((oc == SNAP_NONE) && (nc == SNAP_NONE)) {
+      // directory done: report it and add its totals to the parent
+      path[f->plen] = '\0';
+      if ((f->what == 'S') && (f->osize != f->nsize)) diff_line('S', f->osize, f->nsize, path, NULL);
+      else if (f->what == 'D') diff_line('D', os->rec[f->o].size + f->osize, DIFF_NOSIZE, path, NULL);
+      else if (f->what == 'A') diff_line('A', DIFF_NOSIZE, ns->rec[f->n].size + f->nsize, path, NULL);
+      if (--depth > 0) {
+        stack[depth - 1].osize += f->osize;
+        stack[depth - 1].nsize += f->nsize;
+      }
+      continue;
+    }
+
+    // next name in either snapshot; a name present in both is consumed from both
+    int cmp = (oc == SNAP_NONE) ? 1 : (nc == SNAP_NONE) ? -1 :
+              strcmp(os->str + os->rec[oc].name, ns->str + ns->rec[nc].name);
+    if (cmp <= 0) cursor_pop(&f->oc, oc);
+    else oc = SNAP_NONE;
+    if (cmp >= 0) cursor_pop(&f->nc, nc);
+    else nc = SNAP_NONE;
+
+    const struct snaprec *oe = (oc != SNAP_NONE) ? &os->rec[oc] : NULL;
+    const struct snaprec *ne = (nc != SNAP_NONE) ? &ns->rec[nc] : NULL;
+    const char *name = oe ? os->str + oe->name : ns->str + ne->name;
+    size_t namelen = strlen(name);
+    bool odir = oe && !oe->err && !oe->oerr && S_ISDIR(oe->mode);
+    bool ndir = ne && !ne->err && !ne->oerr && S_ISDIR(ne->mode);
+    size_t clen = f->plen + namelen + 1;
+    char what = f->what;
+
+    if (oe && !oe->err) f->osize += oe->size;
+    if (ne && !ne->err) f->nsize += ne->size;
+
+    if (clen + 1 > pcap) {
+      while (clen + 1 > pcap) pcap *= 2;
+      path = (char*)xrealloc(path, pcap);
+    }
+    memcpy(path + f->plen, name, namelen + 1);
+
+    if (what != 'S') {
+      // inside an added or removed subtree only the sizes are gathered
+      if (odir || ndir) diff_push(os, ns, &stack, &depth, &cap, odir ? oc : SNAP_NONE, ndir ? nc : SNAP_NONE, clen, 0);
+    }
+    else if (!ne) {
+      st->removed++;
+      if (odir) diff_push(os, ns, &stack, &depth, &cap, oc, SNAP_NONE, clen, 'D');
+      else diff_line('D', oe->err ? DIFF_NOSIZE : oe->size, DIFF_NOSIZE, path, NULL);
+    }
+    else if (!oe) {
+      st->added++;
+      if (ndir) diff_push(os, ns, &stack, &depth, &cap, SNAP_NONE, nc, clen, 'A');
+      else diff_line('A', DIFF_NOSIZE, ne->err ? DIFF_NOSIZE : ne->size, path, NULL);
+    }
+    else if (oe->err || ne->err) diff_unknown(path, oe->err, ne->err, st);
+    else if ((oe->mode & S_IFMT) != (ne->mode & S_IFMT)) {
+      char note[64];
+      snprintf(note, sizeof(note), " (%s -> %s)", type_name(oe->mode), type_name(ne->mode));
+      diff_line('T', oe->size, ne->size, path, note);
+      st->retyped++;
+      // the contents of a directory that became or replaced another type count as well
+      if (odir || ndir) diff_push(os, ns, &stack, &depth, &cap, odir ? oc : SNAP_NONE, ndir ? nc : SNAP_NONE, clen, 0);
+    }
+    else if (S_ISDIR(oe->mode)) {
+      if (oe->oerr || ne->oerr) {
+        path[clen - 1] = '/';
+        path[clen] = '\0';
+        diff_unknown(path, oe->oerr, ne->oerr, st);
+      }
+      else diff_push(os, ns, &stack, &depth, &cap, oc, nc, clen, 'S');
+    }
+    else if (oe->size != ne->size) {
+      diff_line('M', oe->size, ne->size, path, NULL);
+      st->resized++;
+    }
+
+    // directories are printed with a trailing '/'
+    path[clen - 1] = '/';
+  }
+
+  free(stack);
+  free(path);
+}
+
+/// @brief compare snapshot @a oldpath with snapshot @a newpath and print added, removed,
+///        resized and type-changed entries as well as the size delta of every directory whose
+///        total size changed. Root directories are paired in argument order.
+///
+/// @param oldpath old snapshot file
+/// @param newpath new snapshot file
+/// @retval 0 if the snapshots do not differ
+/// @retval 1 if they differ
+/// @retval 2 on error
+int snap_diff(const char *oldpath, const char *newpath)
+{
+  struct snapreader os, ns;
+
+  if (snap_map(oldpath, &os) < 0) {
+    perror(oldpath);
+    return 2;
+  }
+  if (snap_map(newpath, &ns) < 0) {
+    perror(newpath);
+    return 2;
+  }
+  if (os.hdr->nroots != ns.hdr->nroots) {
+    fprintf(stderr, "%s and %s do not have the same number of root directories.\n", oldpath, newpath);
+    return 2;
+  }
+
+  bool differ = false;
+  for (unsigned int i = 0; i < os.hdr->nroots; i++) {
+    struct diffstat st = { 0 };
+
+    out_printf("%s -> %s\n", os.str + os.rec[os.roots[i]].name, ns.str + ns.rec[ns.roots[i]].name);
+    out_printf("  %15s %15s %16s  %s\n", "Old size", "New size", "Delta", "Path");
+    diff_tree(&os, &ns, os.roots[i], ns.roots[i], &st);
+    out_printf("%llu added, %llu removed, %llu resized, %llu type changed, %llu not comparable\n\n",
+               st.added, st.removed, st.resized, st.retyped, st.unknown);
+    differ |= (st.added | st.removed | st.resized | st.retyped | st.unknown) != 0;
+  }
+
+  return differ ? 1 : 0;
+}
+
+
+/// @brief map the snapshot of the previous traversal for --since
+///
+/// @param path snapshot file
+/// @retval 0 on success
+/// @retval -1 on error (errno set; EINVAL if the file is not a valid snapshot)
+int since_load(const char *path)
+{
+  return snap_map(path, &prev);
+}
+
+/// @brief select the root directory @a name of the previous snapshot for the traversal that
+///        follows; there is none if it was not traversed by that name
+///
+/// @param name directory as given on the command line
+void since_root(const char *name)
+{
+  prev_root = SNAP_NONE;
+  for (uint32_t i = 0; i < prev.hdr->nroots; i++) {
+    if (strcmp(prev.str + prev.rec[prev.roots[i]].name, name) == 0) prev_root = prev.roots[i];
+  }
+}
+
+/// @brief record index of the root directory selected by since_root() or SNAP_NONE
+uint32_t since_last_root(void)
+{
+  return prev_root;
+}
+
+/// @brief look up entry @a name of directory @a dir in the previous snapshot. Both runs of
+///        children are sorted by name, so this is a binary search in each.
+///
+/// @param dir record index of the directory or SNAP_NONE
+/// @param name name of the entry
+/// @retval record index
+/// @retval SNAP_NONE if there is no such entry
+uint32_t since_child(uint32_t dir, const char *name)
+{
+  if (dir == SNAP_NONE) return SNAP_NONE;
+
+  const struct snaprec *d = &prev.rec[dir];
+  uint32_t runs[3] = { d->first, d->first + d->ndir, d->first + d->nchild };
+
+  for (int k = 0; k < 2; k++) {
+    uint32_t lo = runs[k], hi = runs[k+1];
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      int c = strcmp(prev.str + prev.rec[mid].name, name);
+      if (c == 0) return mid;
+      if (c < 0) lo = mid + 1;
+      else hi = mid;
+    }
+  }
+  return SNAP_NONE;
+}
+
+/// @brief whether directory @a dir has not changed since the previous snapshot: same inode,
+///        modification and status change time, and it was listed completely back then.
+///        Creating, removing or renaming an entry updates the modification time of the
+///        directory, and resetting it (utimes) updates the status change time.
+///
+/// @param dir record index of the directory or SNAP_NONE
+/// @param stx statx result of the directory with STATX_INO, STATX_MTIME and STATX_CTIME
+/// @retval true if its listing can be reused
+bool since_unchanged(uint32_t dir, const struct statx *stx)
+{
+  if (dir == SNAP_NONE) return false;
+
+  const struct snaprec *d = &prev.rec[dir];
+  return (d->ino == stx->stx_ino) && (d->mtime == statx_ns(&stx->stx_mtime)) &&
+         (d->ctime == statx_ns(&stx->stx_ctime)) && S_ISDIR(d->mode) && !d->err && !d->oerr &&
+         !d->rerr;
+}
+
+/// @brief list the entries of unchanged directory @a dir from the previous snapshot, in the
+///        (sorted) order they were printed in
+///
+/// @param dir record index of the directory
+/// @param l empty listing (output)
+void since_listing(uint32_t dir, struct listing *l)
+{
+  const struct snaprec *d = &prev.rec[dir];
+
+  for (uint32_t i = 0; i < d->nchild; i++) {
+    const struct snaprec *e = &prev.rec[d->first + i];
+    const char *name = prev.str + e->name;
+
+    // d_type as the traversal saw it: DT_DIR in the leading run only (a subdirectory the file
+    // system reported as DT_UNKNOWN was sorted among the other entries)
+    unsigned char type = (i < d->ndir) ? DT_DIR : S_ISDIR(e->mode) ? DT_UNKNOWN : IFTODT(e->mode);
+    listing_push(l, e->ino, type, name, strlen(name));
+  }
+}
+
+/// @brief --trust-dir-mtime: copy the metadata of the entries of unchanged directory @a dir
+///        from the previous snapshot instead of retrieving it
+///
+/// @param dir record index of the directory
+/// @param info metadata of the entries (output)
+void since_info(uint32_t dir, struct einfo *info)
+{
+  const struct snaprec *d = &prev.rec[dir];
+
+  for (uint32_t i = 0; i < d->nchild; i++) {
+    const struct snaprec *e = &prev.rec[d->first + i];
+    info[i] = (struct einfo){ .size = e->size, .blocks = e->blocks, .mtime = e->mtime,
+                              .ctime = e->ctime, .mode = e->mode, .uid = e->uid, .gid = e->gid,
+                              .err = e->err };
+  }
+}
@@ -0,0 +1,230 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                     Fall 2024
+//
+/// @file
+/// @brief io_uring backend retrieving the metadata of all entries of a directory in one batch
+/// @author <Jeon minseo>
+/// @studid <2019-19932>
+///
+/// Instead of one blocking fstatat() per entry, an IORING_OP_STATX request relative to the
+/// directory descriptor is queued for every entry and the completions are reaped in whatever
+/// order they arrive. On cold caches and network file systems the lookups then overlap instead
+/// of being serialized. The ring is set up through the raw system calls (no liburing); if that
+/// fails the caller falls back to the synchronous path. So does a batch whose io_uring_enter()
+/// fails for good: its remaining entries are stat()ed synchronously and the thread does not use
+/// its ring again. Requests the kernel rejects as unsupported are retried with statx().
+//--------------------------------------------------------------------------------------------------
+
+#include "dirtree.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+
+#define URING_ENTRIES 256     ///< number of submission queue entries (= requests in flight)
+#define URING_RETRIES 16      ///< io_uring_enter() calls in a row that may fail with EAGAIN/EBUSY
+
+/// @brief io_uring instance with its mapped rings
+struct uring {
+  int fd;                     ///< ring file descriptor
+  unsigned *sq_head;          ///< submission queue head (advanced by the kernel)
+  unsigned *sq_tail;          ///< submission queue tail (advanced by us)
+  unsigned sq_mask;           ///< submission queue index mask
+  unsigned *sq_array;         ///< submission queue index array
+  struct io_uring_sqe *sqes;  ///< submission queue entries
+  unsigned *cq_head;          ///< completion queue head (advanced by us)
+  unsigned *cq_tail;          ///< completion queue tail (advanced by the kernel)
+  unsigned cq_mask;           ///< completion queue index mask
+  struct io_uring_cqe *cqes;  ///< completion queue entries
+  unsigned entries;           ///< number of submission queue entries
+  struct statx *stx;          ///< one result buffer per request in flight
+  size_t *slot;               ///< entry index of the request in flight in each buffer
+};
+
+static __thread struct uring ring;  ///< ring of the calling thread
+static __thread int ring_state;     ///< 0: not set up yet, 1: ready, -1: unavailable
+
+
+/// @brief set up the ring of the calling thread
+///
+/// @retval 0 on success
+/// @retval -1 if io_uring is not available
+static int uring_setup(void)
+{
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+  if (ring.fd < 0) return -1;
+
+  // IORING_OP_STATX needs Linux 5.6; ask the kernel whether it supports the opcode
+  size_t psize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = (struct io_uring_probe*)xmalloc(psize);
+  memset(probe, 0, psize);
+  bool supported = (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) == 0) &&
+                   (probe->last_op >= IORING_OP_STATX) &&
+                   (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  if (!supported) {
+    close(ring.fd);
+    return -1;
+  }
+
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) && (cq_size > sq_size)) sq_size = cq_size;
+
+  char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                  IORING_OFF_SQ_RING);
+  char *cq = sq;
+  if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+              IORING_OFF_CQ_RING);
+  }
+  void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  if ((sq == MAP_FAILED) || (cq == MAP_FAILED) || (sqes == MAP_FAILED)) {
+    close(ring.fd);
+    return -1;
+  }
+
+  ring.sq_head = (unsigned*)(sq + p.sq_off.head);
+  ring.sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  ring.sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+  ring.sq_array = (unsigned*)(sq + p.sq_off.array);
+  ring.sqes = (struct io_uring_sqe*)sqes;
+  ring.cq_head = (unsigned*)(cq + p.cq_off.head);
+  ring.cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  ring.cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  ring.entries = p.sq_entries;
+
+  ring.stx = (struct statx*)xmalloc(ring.entries * sizeof(struct statx));
+  ring.slot = (size_t*)xmalloc(ring.entries * sizeof(size_t));
+
+  return 0;
+}
+
+/// @brief give up the ring of the calling thread after an error. Requests still in flight may
+///        complete into the result buffers, so those are not freed.
+static void uring_fail(void)
+{
+  close(ring.fd);
+  ring_state = -1;
+}
+
+/// @brief release the ring of the calling thread. The mappings go away with the process.
+void uring_release(void)
+{
+  if (ring_state == 1) {
+    close(ring.fd);
+    free(ring.stx);
+    free(ring.slot);
+  }
+  ring_state = 0;
+}
+
+/// @brief retrieve the metadata of all entries of listing @a l with batched IORING_OP_STATX
+///        requests relative to directory @a dfd. Symbolic links are not followed. Entries
+///        whose d_type satisfies @a mask are not submitted.
+///
+/// @param dfd directory descriptor
+/// @param l listing
+/// @param info metadata of the entries (output)
+/// @param mask statx field mask (STATX_*)
+/// @retval 0 on success (also if the batch had to be finished synchronously)
+/// @retval -1 if io_uring is not available; nothing has been retrieved
+int uring_stat_listing(int dfd, const struct listing *l, struct einfo *info, unsigned int mask)
+{
+  if (ring_state == 0) ring_state = uring_setup() == 0 ? 1 : -1;
+  if (ring_state < 0) return -1;
+
+  unsigned free_slots[URING_ENTRIES];
+  bool inflight[URING_ENTRIES] = { false };
+  unsigned nfree = 0;
+  for (unsigned i = 0; i < ring.entries; i++) free_slots[nfree++] = i;
+
+  size_t next = 0;          // next entry to submit
+  size_t pending = 0;       // requests in flight
+  unsigned retries = 0;     // io_uring_enter() calls in a row that failed temporarily
+
+  while ((next < l->num) || (pending > 0)) {
+    // fill the submission queue
+    unsigned tail = *ring.sq_tail;
+    while ((next < l->num) && (nfree > 0)) {
+      if (einfo_from_dtype(&info[next], &l->ents[next], mask)) {
+        next++;
+        continue;
+      }
+
+      unsigned s = free_slots[--nfree];
+      unsigned idx = tail & ring.sq_mask;
+      struct io_uring_sqe *sqe = &ring.sqes[idx];
+
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = dfd;
+      sqe->addr = (unsigned long)(l->names + l->ents[next].name);
+      sqe->len = mask;
+      sqe->off = (unsigned long)&ring.stx[s];
+      sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC;
+      sqe->user_data = s;
+      ring.sq_array[idx] = idx;
+      ring.slot[s] = next++;
+      inflight[s] = true;
+
+      tail++;
+      pending++;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+    if (pending == 0) break;
+
+    // submit everything not yet consumed by the kernel and wait for at least one completion.
+    // EAGAIN/EBUSY: the kernel is short of resources or the completion queue is full; reap what
+    // has completed and try again. Any other error (or too many retries): stat the rest of the
+    // batch synchronously.
+    unsigned to_submit = tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    int r;
+    do {
+      r = syscall(__NR_io_uring_enter, ring.fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while ((r < 0) && (errno == EINTR));
+    counters.uring_enters++;
+    if ((r < 0) && (((errno != EAGAIN) && (errno != EBUSY)) || (++retries > URING_RETRIES))) {
+      for (unsigned s = 0; s < ring.entries; s++) {
+        if (inflight[s]) stat_entry(dfd, l, ring.slot[s], &info[ring.slot[s]], mask);
+      }
+      for (; next < l->num; next++) {
+        if (!einfo_from_dtype(&info[next], &l->ents[next], mask)) stat_entry(dfd, l, next, &info[next], mask);
+      }
+      uring_fail();
+      return 0;
+    }
+    if (r >= 0) retries = 0;
+
+    // reap all available completions
+    unsigned head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+      unsigned s = cqe->user_data;
+      size_t i = ring.slot[s];
+
+      if ((cqe->res == -EINVAL) || (cqe->res == -EOPNOTSUPP)) {
+        // the kernel cannot do this statx through io_uring (opcode or flags not supported)
+        stat_entry(dfd, l, i, &info[i], mask);
+      } else if (cqe->res < 0) {
+        memset(&info[i], 0, sizeof(info[i]));
+        info[i].err = -cqe->res;
+        counters.stats++;
+      } else {
+        einfo_from_statx(&info[i], &ring.stx[s]);
+        counters.stats++;
+      }
+
+      inflight[s] = false;
+      free_slots[nfree++] = s;
+      pending--;
+      head++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  return 0;
+}
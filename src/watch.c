@@ -0,0 +1,780 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                     Fall 2024
+//
+/// @file
+/// @brief watch mode (--watch): an in-memory tree kept current with inotify
+/// @author <Jeon minseo>
+/// @studid <2019-19932>
+///
+/// The initial traversal loads every directory below the roots into memory and adds an inotify
+/// watch to each. Events then update the tree: created and moved-in entries are stat()ed (and
+/// directories loaded), deleted and moved-out ones are dropped, and modified ones are stat()ed
+/// again. Every directory carries the totals of its subtree; an update adds its difference to
+/// the directory and its ancestors, so the totals of a root are always current and reading them
+/// costs nothing.
+///
+/// On SIGUSR1 the tree is printed to stdout exactly like a normal run with the same options.
+/// Clients of the Unix socket given with --watch-socket send one request line: "tree" (or
+/// nothing) is answered with the full output, "summary" with one line of totals per root. The
+/// sockets are non-blocking and served from the event loop: the answer is rendered into memory
+/// at once and sent as the client reads it, so a client that stalls holds up neither the
+/// inotify events nor the signals.
+//--------------------------------------------------------------------------------------------------
+
+#include "dirtree.h"
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+
+/// events of interest: anything that changes the entries of a directory or their metadata
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | \
+                      IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+#define WATCH_EVBUF  (64*1024)  ///< size of the inotify read buffer
+#define WATCH_REQ    64         ///< maximum length of a socket request
+#define WATCH_CLIENTS 16        ///< clients served at once; more wait in the listen backlog
+#define WATCH_TIMEOUT 1000      ///< milliseconds a client has to send its request line
+#define WATCH_STALL  10000      ///< milliseconds a client may not read its answer before it is dropped
+
+struct wdir;
+
+/// @brief entry of a watched directory
+struct wentry {
+  struct wentry *hnext;       ///< next entry in the same hash bucket
+  struct wdir *dir;           ///< directory holding the entry
+  struct wdir *sub;           ///< node of the entry if it is a directory, else NULL
+  uint32_t idx;               ///< index of the entry in dir->ents
+  struct einfo info;          ///< metadata
+  uint16_t namelen;           ///< length of the name
+  char name[];                ///< null-terminated name
+};
+
+/// @brief watched directory
+struct wdir {
+  struct wdir *parent;        ///< parent directory (NULL for roots)
+  struct wentry *self;        ///< entry of the directory in its parent (NULL for roots)
+  const char *path;           ///< roots: path as given on the command line
+  int wd;                     ///< inotify watch descriptor or -1
+  int err;                    ///< errno if the directory could not be opened
+  int rerr;                   ///< errno if reading the directory failed
+  struct wentry **ents;       ///< entries, in no particular order
+  uint32_t num;               ///< number of entries
+  uint32_t cap;               ///< capacity of ents
+  struct summary sum;         ///< totals of all entries below the directory
+};
+
+/// @brief client of the query socket
+struct wclient {
+  int fd;                     ///< socket (-1: slot unused)
+  char req[WATCH_REQ + 1];    ///< request line received so far
+  size_t rlen;                ///< length of req
+  long long deadline;         ///< time (CLOCK_MONOTONIC, ms) the request is taken as complete,
+                              ///< or, once answered, the client is dropped unless it reads on
+  bool answered;              ///< the answer is in out
+  struct membuf out;          ///< answer
+  size_t sent;                ///< bytes of out sent
+};
+
+/// @brief state of watch mode
+struct watcher {
+  int ifd;                    ///< inotify descriptor
+  unsigned int flags;         ///< output control flags (F_*)
+  struct wdir *roots[MAX_DIR];///< root directories
+  int nroots;                 ///< number of root directories
+  struct wentry **hash;       ///< entries by directory and name (chained)
+  size_t hcap;                ///< number of buckets (power of two)
+  size_t hnum;                ///< number of entries
+  struct wdir **wds;          ///< directory of each watch descriptor (NULL: none)
+  size_t nwds;                ///< size of wds
+  char *path;                 ///< path buffer
+  size_t pcap;                ///< capacity of path
+  bool limit_warned;          ///< the inotify watch limit has been reported
+  struct wclient clients[WATCH_CLIENTS]; ///< clients of the query socket
+};
+
+static struct watcher wt;     ///< --watch state
+
+
+/// @brief hash bucket of entry @a name of directory @a d
+static size_t ent_bucket(const struct wdir *d, const char *name)
+{
+  // FNV-1a over the name, mixed with the directory
+  uint64_t h = 14695981039346656037ULL ^ ((uintptr_t)d * 0x9e3779b97f4a7c15ULL);
+  for (; *name; name++) h = (h ^ (unsigned char)*name) * 1099511628211ULL;
+  return h & (wt.hcap - 1);
+}
+
+/// @brief entry @a name of directory @a d or NULL
+static struct wentry *ent_find(const struct wdir *d, const char *name)
+{
+  struct wentry *e = wt.hash[ent_bucket(d, name)];
+  while (e && ((e->dir != d) || strcmp(e->name, name))) e = e->hnext;
+  return e;
+}
+
+/// @brief add (@a sign = 1) or subtract (@a sign = -1) the totals @a s to/from directory @a d
+///        and all its ancestors
+static void sum_add(struct wdir *d, const struct summary *s, int sign)
+{
+  for (; d; d = d->parent) {
+    if (sign > 0) summary_merge(&d->sum, s);
+    else {
+      d->sum.files -= s->files;
+      d->sum.dirs -= s->dirs;
+      d->sum.links -= s->links;
+      d->sum.fifos -= s->fifos;
+      d->sum.socks -= s->socks;
+      d->sum.size -= s->size;
+      d->sum.blocks -= s->blocks;
+    }
+  }
+}
+
+/// @brief add or subtract the entry with metadata @a info to/from the totals of @a d and its
+///        ancestors. Entries whose metadata could not be retrieved are not counted.
+static void sum_entry(struct wdir *d, const struct einfo *info, int sign)
+{
+  struct summary s = { 0 };
+
+  if (info->err) return;
+  update_stats(&s, info, wt.flags);
+  sum_add(d, &s, sign);
+}
+
+/// @brief add entry @a name with metadata @a info to directory @a d
+///
+/// @retval new entry
+static struct wentry *ent_add(struct wdir *d, const char *name, size_t len, const struct einfo *info)
+{
+  struct wentry *e = (struct wentry*)xmalloc(sizeof(struct wentry) + len + 1);
+  memcpy(e->name, name, len);
+  e->name[len] = '\0';
+  e->namelen = len;
+  e->dir = d;
+  e->sub = NULL;
+  e->info = *info;
+
+  if (d->num == d->cap) {
+    d->cap = d->cap ? 2*d->cap : 16;
+    d->ents = (struct wentry**)xrealloc(d->ents, d->cap * sizeof(struct wentry*));
+  }
+  e->idx = d->num;
+  d->ents[d->num++] = e;
+
+  // grow the hash table at a load factor of 1
+  if (++wt.hnum > wt.hcap) {
+    struct wentry **old = wt.hash;
+    size_t ocap = wt.hcap;
+    wt.hcap *= 2;
+    wt.hash = (struct wentry**)xmalloc(wt.hcap * sizeof(struct wentry*));
+    memset(wt.hash, 0, wt.hcap * sizeof(struct wentry*));
+    for (size_t i = 0; i < ocap; i++) {
+      while (old[i]) {
+        struct wentry *x = old[i];
+        old[i] = x->hnext;
+        size_t b = ent_bucket(x->dir, x->name);
+        x->hnext = wt.hash[b];
+        wt.hash[b] = x;
+      }
+    }
+    free(old);
+  }
+  size_t b = ent_bucket(d, e->name);
+  e->hnext = wt.hash[b];
+  wt.hash[b] = e;
+
+  sum_entry(d, info, 1);
+  return e;
+}
+
+/// @brief unlink entry @a e from the hash table and its directory and free it. Totals are
+///        not touched.
+static void ent_free(struct wentry *e)
+{
+  struct wentry **p = &wt.hash[ent_bucket(e->dir, e->name)];
+  while (*p != e) p = &(*p)->hnext;
+  *p = e->hnext;
+  wt.hnum--;
+
+  struct wdir *d = e->dir;
+  d->ents[e->idx] = d->ents[--d->num];
+  d->ents[e->idx]->idx = e->idx;
+  free(e);
+}
+
+/// @brief create the node of directory entry @a e (not loaded yet)
+static struct wdir *dir_new(struct wdir *parent, struct wentry *e)
+{
+  struct wdir *d = (struct wdir*)xmalloc(sizeof(struct wdir));
+  memset(d, 0, sizeof(*d));
+  d->parent = parent;
+  d->self = e;
+  d->wd = -1;
+  if (e) e->sub = d;
+  return d;
+}
+
+/// @brief free directory @a d, everything below it and their watches. Totals are not touched.
+static void dir_free(struct wdir *d)
+{
+  struct wdir **stack = NULL;
+  size_t depth = 0, cap = 0;
+
+  for (;;) {
+    // free the entries of d, collecting its subdirectories
+    while (d->num > 0) {
+      struct wentry *e = d->ents[d->num - 1];
+      if (e->sub) {
+        if (depth == cap) {
+          cap = cap ? 2*cap : 64;
+          stack = (struct wdir**)xrealloc(stack, cap * sizeof(struct wdir*));
+        }
+        stack[depth++] = e->sub;
+      }
+      ent_free(e);
+    }
+    if ((d->wd >= 0) && (wt.ifd >= 0)) {
+      inotify_rm_watch(wt.ifd, d->wd);
+      wt.wds[d->wd] = NULL;
+    }
+    free(d->ents);
+    free(d);
+
+    if (depth == 0) break;
+    d = stack[--depth];
+  }
+  free(stack);
+}
+
+/// @brief path of directory @a d (in the path buffer)
+///
+/// @retval length of the path
+static size_t dir_path(const struct wdir *d)
+{
+  // measure, then fill in from the end
+  size_t len = 0;
+  const struct wdir *p;
+  for (p = d; p->parent; p = p->parent) len += p->self->namelen + 1;
+  len += strlen(p->path);
+  if (len + NAME_MAX + 2 > wt.pcap) {
+    while (len + NAME_MAX + 2 > wt.pcap) wt.pcap *= 2;
+    wt.path = (char*)xrealloc(wt.path, wt.pcap);
+  }
+
+  size_t pos = len;
+  wt.path[len] = '\0';
+  for (p = d; p->parent; p = p->parent) {
+    pos -= p->self->namelen;
+    memcpy(wt.path + pos, p->self->name, p->self->namelen);
+    wt.path[--pos] = '/';
+  }
+  memcpy(wt.path, p->path, pos);
+  return len;
+}
+
+/// @brief add an inotify watch to directory @a d open on @a fd
+static void dir_watch(struct wdir *d, int fd)
+{
+  char proc[64];
+
+  // through the descriptor: no path length limit and no race with renames
+  snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+  int wd = inotify_add_watch(wt.ifd, proc, WATCH_EVENTS);
+  if (wd < 0) {
+    if ((errno == ENOSPC) && !wt.limit_warned) {
+      out_flush();
+      fprintf(stderr, "Warning: inotify watch limit reached (fs.inotify.max_user_watches); "
+                      "some directories are not kept current.\n");
+      wt.limit_warned = true;
+    }
+    return;
+  }
+
+  if ((size_t)wd >= wt.nwds) {
+    size_t n = wt.nwds ? 2*wt.nwds : 1024;
+    while ((size_t)wd >= n) n *= 2;
+    wt.wds = (struct wdir**)xrealloc(wt.wds, n * sizeof(struct wdir*));
+    memset(wt.wds + wt.nwds, 0, (n - wt.nwds) * sizeof(struct wdir*));
+    wt.nwds = n;
+  }
+  // the same directory reachable twice (bind mounts) shares the watch of its first node
+  if (wt.wds[wd] != NULL) return;
+  wt.wds[wd] = d;
+  d->wd = wd;
+}
+
+/// @brief load directory @a d and everything below it: watch, read and stat every directory.
+///        The watch is added before the directory is read, so no change is missed.
+static void dir_load(struct wdir *d)
+{
+  struct wdir **stack = NULL;
+  size_t depth = 0, cap = 0;
+
+  for (;;) {
+    dir_path(d);
+    int fd = open(wt.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (d->parent ? O_NOFOLLOW : 0));
+    if (fd < 0) d->err = errno;
+    else {
+      counters.opens++;
+      dir_watch(d, fd);
+
+      struct listing l = { 0 };
+      struct arena_mark ent_mark = arena_mark(&ent_arena);
+      struct arena_mark str_mark = arena_mark(&str_arena);
+      d->rerr = read_listing(fd, &l, NULL, wt.flags);
+      struct einfo *info = (struct einfo*)arena_alloc(&ent_arena, l.num * sizeof(struct einfo));
+      stat_listing(fd, &l, info, wt.flags | F_SUMMARY);
+      close(fd);
+
+      for (size_t i = 0; i < l.num; i++) {
+        struct wentry *e = ent_add(d, l.names + l.ents[i].name, l.ents[i].namelen, &info[i]);
+        if (info[i].err || !S_ISDIR(info[i].mode)) continue;
+        if (depth == cap) {
+          cap = cap ? 2*cap : 64;
+          stack = (struct wdir**)xrealloc(stack, cap * sizeof(struct wdir*));
+        }
+        stack[depth++] = dir_new(d, e);
+      }
+      arena_release(&ent_arena, ent_mark);
+      arena_release(&str_arena, str_mark);
+    }
+
+    if (depth == 0) break;
+    d = stack[--depth];
+  }
+  free(stack);
+}
+
+/// @brief remove entry @a e of directory @a d with everything below it
+static void ent_remove(struct wdir *d, struct wentry *e)
+{
+  if (e->sub) {
+    sum_add(d, &e->sub->sum, -1);
+    dir_free(e->sub);
+  }
+  sum_entry(d, &e->info, -1);
+  ent_free(e);
+}
+
+/// @brief bring entry @a name of directory @a d up to date: stat it and add, update or remove it
+static void ent_refresh(struct wdir *d, const char *name)
+{
+  struct wentry *e = ent_find(d, name);
+  struct einfo info;
+  struct statx stx;
+
+  size_t len = dir_path(d);
+  wt.path[len] = '/';
+  strcpy(wt.path + len + 1, name);
+  if (statx(AT_FDCWD, wt.path, AT_SYMLINK_NOFOLLOW, stat_mask(wt.flags | F_SUMMARY), &stx) < 0) {
+    memset(&info, 0, sizeof(info));
+    info.err = errno;
+  }
+  else einfo_from_statx(&info, &stx);
+  counters.stats++;
+
+  // gone again (or replaced by a different type): drop the old entry
+  if ((info.err == ENOENT) || (e && (e->sub != NULL) != (!info.err && S_ISDIR(info.mode)))) {
+    if (e) ent_remove(d, e);
+    e = NULL;
+    if (info.err == ENOENT) return;
+  }
+
+  if (e) {
+    sum_entry(d, &e->info, -1);
+    e->info = info;
+    sum_entry(d, &e->info, 1);
+  }
+  else {
+    e = ent_add(d, name, strlen(name), &info);
+    if (!info.err && S_ISDIR(info.mode)) dir_load(dir_new(d, e));
+  }
+}
+
+/// @brief reload all roots from scratch (after the event queue overflowed). The watches are
+///        dropped all at once with a new inotify instance: removing them one by one would
+///        queue an IN_IGNORED event each and overflow the queue again.
+static void watch_reload(void)
+{
+  close(wt.ifd);
+  wt.ifd = -1;
+  memset(wt.wds, 0, wt.nwds * sizeof(struct wdir*));
+  for (int i = 0; i < wt.nroots; i++) dir_free(wt.roots[i]);
+
+  wt.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (wt.ifd < 0) panic("inotify_init1 failed.");
+  for (int i = 0; i < wt.nroots; i++) {
+    const char *path = wt.roots[i]->path;
+    wt.roots[i] = dir_new(NULL, NULL);
+    wt.roots[i]->path = path;
+    dir_load(wt.roots[i]);
+  }
+}
+
+/// @brief apply inotify event @a ev to the tree
+static void watch_event(const struct inotify_event *ev)
+{
+  if ((ev->wd < 0) || ((size_t)ev->wd >= wt.nwds) || (wt.wds[ev->wd] == NULL)) return;
+
+  struct wdir *d = wt.wds[ev->wd];
+  if (ev->mask & IN_IGNORED) {
+    // the watch is gone (directory deleted or unmounted)
+    wt.wds[ev->wd] = NULL;
+    d->wd = -1;
+    return;
+  }
+
+  if (ev->len == 0) {
+    // the directory itself: a root that went away is emptied, others are updated through
+    // their parent
+    if (d->parent) {
+      if (ev->mask & IN_ATTRIB) ent_refresh(d->parent, d->self->name);
+    }
+    else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+      while (d->num > 0) ent_remove(d, d->ents[d->num - 1]);
+      d->err = ENOENT;
+    }
+    return;
+  }
+
+  if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+    struct wentry *e = ent_find(d, ev->name);
+    if (e) ent_remove(d, e);
+  }
+  else ent_refresh(d, ev->name);
+
+  // adding or removing entries changes the size of the directory itself
+  if ((ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) && d->parent) {
+    ent_refresh(d->parent, d->self->name);
+  }
+}
+
+/// @brief order of entries in the output: directories first, then by name (see dirent_compare())
+static int wentry_compare(const void *a, const void *b)
+{
+  const struct wentry *x = *(struct wentry* const*)a;
+  const struct wentry *y = *(struct wentry* const*)b;
+  bool xd = !x->info.err && S_ISDIR(x->info.mode);
+  bool yd = !y->info.err && S_ISDIR(y->info.mode);
+
+  if (xd != yd) return xd ? -1 : 1;
+  return strcmp(x->name, y->name);
+}
+
+/// @brief print the tree below root directory @a r like processDir()
+static void watch_print_tree(const struct wdir *r, struct prefix *pfx)
+{
+  // directory, its entries in output order and the next one to print, for every level
+  struct level { const struct wdir *d; struct wentry **ents; uint32_t next; } *stack = NULL;
+  size_t depth = 0, cap = 0;
+
+  if (r->err) {
+    print_errno(pfx, r->err, wt.flags);
+    return;
+  }
+
+  const struct wdir *d = r;
+  for (;;) {
+    if (d) {
+      if (depth == cap) {
+        cap = cap ? 2*cap : 64;
+        stack = (struct level*)xrealloc(stack, cap * sizeof(struct level));
+      }
+      struct level *lv = &stack[depth++];
+      lv->d = d;
+      lv->next = 0;
+      lv->ents = (struct wentry**)xmalloc((d->num + 1) * sizeof(struct wentry*));
+      memcpy(lv->ents, d->ents, d->num * sizeof(struct wentry*));
+      qsort(lv->ents, d->num, sizeof(struct wentry*), wentry_compare);
+      if (d->rerr) print_read_error(d->rerr);
+      d = NULL;
+    }
+
+    struct level *lv = &stack[depth - 1];
+    if (lv->next == lv->d->num) {
+      free(lv->ents);
+      if (--depth == 0) break;
+      prefix_pop(pfx);
+      continue;
+    }
+
+    const struct wentry *e = lv->ents[lv->next++];
+    print_entry(pfx, e->name, e->namelen, &e->info, lv->next == lv->d->num, wt.flags);
+    if (e->sub) {
+      prefix_push(pfx);
+      if (e->sub->err) {
+        print_errno(pfx, e->sub->err, wt.flags);
+        prefix_pop(pfx);
+      }
+      else d = e->sub;
+    }
+  }
+  free(stack);
+}
+
+/// @brief print all trees with their summaries, exactly like a normal run
+static void watch_print(void)
+{
+  struct prefix pfx = { 0 };
+  struct summary tstat = { 0 };
+
+  for (int i = 0; i < wt.nroots; i++) {
+    if (wt.flags & F_SUMMARY) print_header(wt.flags);
+    out_printf("%s\n", wt.roots[i]->path);
+    watch_print_tree(wt.roots[i], &pfx);
+    if (wt.flags & F_SUMMARY) print_summary(&wt.roots[i]->sum, wt.flags);
+    summary_merge(&tstat, &wt.roots[i]->sum);
+  }
+  if ((wt.flags & F_SUMMARY) && (wt.nroots > 1)) print_totals(wt.nroots, &tstat, wt.flags);
+  free(pfx.buf);
+}
+
+/// @brief print one line with the current totals of every root
+static void watch_print_summary(void)
+{
+  for (int i = 0; i < wt.nroots; i++) {
+    const struct summary *s = &wt.roots[i]->sum;
+    out_printf("%s: files=%llu dirs=%llu links=%llu pipes=%llu sockets=%llu size=%llu blocks=%llu\n",
+               wt.roots[i]->path, s->files, s->dirs, s->links, s->fifos, s->socks, s->size, s->blocks);
+  }
+}
+
+/// @brief current time in milliseconds (CLOCK_MONOTONIC)
+static long long now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/// @brief disconnect client @a c and free its slot
+static void client_close(struct wclient *c)
+{
+  close(c->fd);
+  free(c->out.buf);
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+}
+
+/// @brief send as much of the answer to client @a c as its socket accepts; disconnect it once
+///        the answer is complete or the client has gone away
+static void client_send(struct wclient *c)
+{
+  while (c->sent < c->out.len) {
+    ssize_t n = write(c->fd, c->out.buf + c->sent, c->out.len - c->sent);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+      break;
+    }
+    c->sent += n;
+    c->deadline = now_ms() + WATCH_STALL;
+  }
+  client_close(c);
+}
+
+/// @brief render the answer to the request of client @a c into memory and start sending it
+static void client_answer(struct wclient *c)
+{
+  c->req[c->rlen] = '\0';
+  c->req[strcspn(c->req, "\r\n")] = '\0';
+
+  struct membuf *old = out_capture(&c->out);
+  if (!strcmp(c->req, "tree") || (c->req[0] == '\0')) watch_print();
+  else if (!strcmp(c->req, "summary")) watch_print_summary();
+  else out_printf("Unknown request '%s' (tree, summary).\n", c->req);
+  out_capture(old);
+
+  c->answered = true;
+  c->deadline = now_ms() + WATCH_STALL;
+  client_send(c);
+}
+
+/// @brief read the request line of client @a c as far as it has arrived. A complete line, a
+///        full buffer or the end of the stream is answered.
+static void client_read(struct wclient *c)
+{
+  while (c->rlen < WATCH_REQ) {
+    ssize_t n = read(c->fd, c->req + c->rlen, WATCH_REQ - c->rlen);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+      client_close(c);
+      return;
+    }
+    if (n == 0) break;
+    c->rlen += n;
+    if (memchr(c->req, '\n', c->rlen)) break;
+  }
+  client_answer(c);
+}
+
+/// @brief accept the pending clients of the query socket @a lfd while there are free slots
+static void watch_accept(int lfd)
+{
+  for (int i = 0; i < WATCH_CLIENTS; i++) {
+    struct wclient *c = &wt.clients[i];
+    if (c->fd >= 0) continue;
+
+    c->fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (c->fd < 0) {
+      c->fd = -1;
+      return;
+    }
+    c->deadline = now_ms() + WATCH_TIMEOUT;
+  }
+}
+
+/// @brief create the query socket @a path
+///
+/// @retval listening socket
+static int watch_listen(const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  struct stat st;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: socket path too long.\n", path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, path);
+
+  // a stale socket of an earlier run is replaced, anything else is left alone
+  if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode)) unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if ((fd < 0) || (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(fd, 16) < 0)) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+/// @brief watch mode: load the trees of @a dirs and keep them current until SIGINT or SIGTERM
+///
+/// @param dirs root directories
+/// @param ndir number of root directories
+/// @param sockpath path of the query socket or NULL
+/// @param flags output control flags (F_*)
+/// @retval exit code
+int watch_run(const char **dirs, int ndir, const char *sockpath, unsigned int flags)
+{
+  wt.flags = flags;
+  wt.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (wt.ifd < 0) {
+    perror("inotify_init1");
+    return EXIT_FAILURE;
+  }
+  wt.hcap = 1024;
+  wt.hash = (struct wentry**)xmalloc(wt.hcap * sizeof(struct wentry*));
+  memset(wt.hash, 0, wt.hcap * sizeof(struct wentry*));
+  wt.pcap = PATH_MAX;
+  wt.path = (char*)xmalloc(wt.pcap);
+
+  // signals are read from a descriptor in the event loop; clients that hang up are no reason
+  // to die
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  int sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+  if (sfd < 0) panic("signalfd failed.");
+  signal(SIGPIPE, SIG_IGN);
+  int lfd = sockpath ? watch_listen(sockpath) : -1;
+
+  for (int i = 0; i < ndir; i++) {
+    struct wdir *r = dir_new(NULL, NULL);
+    r->path = dirs[i];
+    wt.roots[wt.nroots++] = r;
+    dir_load(r);
+  }
+  out_flush();
+  fprintf(stderr, "Watching %zu entries (pid %d); send SIGUSR1 to print the tree.\n", wt.hnum,
+          (int)getpid());
+
+  char *evbuf = (char*)xmalloc(WATCH_EVBUF);
+  struct pollfd pfd[3 + WATCH_CLIENTS] = { { .fd = wt.ifd, .events = POLLIN },
+                                           { .fd = sfd, .events = POLLIN } };
+  for (int i = 0; i < WATCH_CLIENTS; i++) wt.clients[i].fd = -1;
+  for (;;) {
+    // the listening socket only while a client slot is free; clients for their request or for
+    // room to send the answer, until their deadline
+    int timeout = -1;
+    long long now = now_ms();
+    pfd[2] = (struct pollfd){ .fd = -1, .events = POLLIN };
+    for (int i = 0; i < WATCH_CLIENTS; i++) {
+      const struct wclient *c = &wt.clients[i];
+      pfd[3 + i] = (struct pollfd){ .fd = c->fd, .events = c->answered ? POLLOUT : POLLIN };
+      if (c->fd < 0) pfd[2].fd = lfd;
+      else {
+        long long wait = (c->deadline > now) ? c->deadline - now : 0;
+        if ((timeout < 0) || (wait < timeout)) timeout = (int)wait;
+      }
+    }
+
+    if (poll(pfd, 3 + WATCH_CLIENTS, timeout) < 0) {
+      if (errno == EINTR) continue;
+      panic("poll failed.");
+    }
+
+    if (pfd[0].revents & POLLIN) {
+      ssize_t n;
+      bool overflow = false;
+      while (!overflow && ((n = read(wt.ifd, evbuf, WATCH_EVBUF)) > 0)) {
+        for (char *p = evbuf; p < evbuf + n; ) {
+          const struct inotify_event *ev = (const struct inotify_event*)p;
+          if (ev->mask & IN_Q_OVERFLOW) {
+            overflow = true;
+            break;
+          }
+          watch_event(ev);
+          p += sizeof(struct inotify_event) + ev->len;
+        }
+      }
+      // events were lost: the tree cannot be patched up any more
+      if (overflow) {
+        out_flush();
+        fprintf(stderr, "Warning: inotify event queue overflowed; reloading.\n");
+        watch_reload();
+        pfd[0].fd = wt.ifd;
+      }
+    }
+
+    if (pfd[1].revents & POLLIN) {
+      struct signalfd_siginfo si;
+      if (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_signo != SIGUSR1) break;
+        watch_print();
+        out_flush();
+      }
+    }
+
+    // clients: a client that sends nothing within WATCH_TIMEOUT gets the tree, one that stops
+    // reading its answer for WATCH_STALL is dropped
+    now = now_ms();
+    for (int i = 0; i < WATCH_CLIENTS; i++) {
+      struct wclient *c = &wt.clients[i];
+      if ((c->fd < 0) || (pfd[3 + i].fd != c->fd)) continue;
+      if (c->answered) {
+        if (pfd[3 + i].revents) client_send(c);
+        else if (now >= c->deadline) client_close(c);
+      }
+      else if (pfd[3 + i].revents) client_read(c);
+      else if (now >= c->deadline) client_answer(c);
+    }
+    if ((pfd[2].fd >= 0) && (pfd[2].revents & POLLIN)) watch_accept(lfd);
+  }
+
+  for (int i = 0; i < WATCH_CLIENTS; i++) {
+    if (wt.clients[i].fd >= 0) client_close(&wt.clients[i]);
+  }
+  if (sockpath) unlink(sockpath);
+  free(evbuf);
+  return EXIT_SUCCESS;
+}
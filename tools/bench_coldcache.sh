@@ -0,0 +1,75 @@
+#!/bin/bash
+#---------------------------------------------------------------------------------------------------
+# System Programming                         I/O Lab                                    Fall 2024
+#
+# benchmark of --io-uring against the synchronous statx path on a cold page and inode cache.
+# Before every run the caches are dropped (needs root; otherwise the runs are warm and a warning
+# is printed). The trees are generated with genbench.sh; use a directory on a real disk (or a
+# network file system), not on tmpfs, where nothing is ever cold.
+#
+# Usage:
+#   bench_coldcache.sh <dir> [dirtree] [runs] [jobs]
+#     dir      directory for the generated trees (created if missing, trees are reused)
+#     dirtree  binary to benchmark. Default: bin/dirtree
+#     runs     runs per configuration; the median is reported. Default: 5
+#     jobs     thread count of the -j runs. Default: 4
+#
+# Every configuration is run with -v (all entries are stat()ed) and -s; the output is discarded.
+#
+
+DIR=$1
+BIN=${2:-bin/dirtree}
+RUNS=${3:-5}
+JOBS=${4:-4}
+GENBENCH=${0%/*}/genbench.sh
+
+if [[ -z "$DIR" ]]; then
+  echo "Usage: $0 <dir> [dirtree] [runs] [jobs]"
+  exit 1
+fi
+if [[ ! -x "$BIN" ]]; then
+  echo "Cannot execute '$BIN'."
+  exit 1
+fi
+
+mkdir -p "$DIR" || exit 1
+[[ -e "$DIR/deep" ]] || "$GENBENCH" deep "$DIR/deep" 12 2 8 || exit 1
+[[ -e "$DIR/flat" ]] || "$GENBENCH" flat "$DIR/flat" 200000 || exit 1
+
+COLD=1
+if ! sync || ! echo 3 2> /dev/null > /proc/sys/vm/drop_caches; then
+  echo "Warning: cannot drop the caches (not root?); the runs are warm."
+  COLD=0
+fi
+
+# median of the numbers on stdin
+median() {
+  sort -n | awk '{ v[NR] = $1 } END { print (NR % 2) ? v[(NR+1)/2] : (v[NR/2] + v[NR/2+1]) / 2 }'
+}
+
+# run dirtree RUNS times on tree $1 with the options $2... and print the median wall time
+bench() {
+  local tree=$1
+  shift
+  for ((i=0; i<RUNS; i++)); do
+    ((COLD)) && sync && echo 3 > /proc/sys/vm/drop_caches
+    local start=$(date +%s%N)
+    "$BIN" -v -s "$@" "$DIR/$tree" > /dev/null || exit 1
+    local end=$(date +%s%N)
+    echo $(((end - start) / 1000000))
+  done | median
+}
+
+# print one result line: tree $1, options $2, median $3 in milliseconds (printed in seconds)
+report() {
+  awk -v t="$1" -v o="${2:-(sync)}" -v ms="$3" 'BEGIN { printf "%-6s %-22s %10.3f\n", t, o, ms / 1000 }'
+}
+
+printf "%-6s %-22s %10s\n" "tree" "options" "median [s]"
+for tree in deep flat; do
+  for opts in "" "--io-uring" "-j $JOBS" "-j $JOBS --io-uring"; do
+    report "$tree" "$opts" "$(bench $tree $opts)"
+  done
+done
+
+exit 0
@@ -0,0 +1,207 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                     Fall 2024
+//
+/// @file
+/// @brief microbenchmark of the listing sort (make bench)
+/// @author <Jeon minseo>
+/// @studid <2019-19932>
+///
+/// Fills a listing with synthetic names in memory and times listing_sort() with
+/// --sort-algo=compare, radix and auto against the qsort_r() path it replaced (struct entry
+/// records compared by type and strcmp()). No file system is involved. Every sort result is
+/// checked against the qsort_r() order.
+///
+/// Name sets (every tenth entry is a directory, the order is shuffled):
+///   numbered  file_<n>                  short shared prefix, mostly decided by the key
+///   prefix    IMG_20240101_<n>.jpg      shared prefix longer than the 8 key bytes
+///   random    1..12 random bytes        the full byte range including bytes >= 0x80
+///   utf8      사진_<n>                   shared multi-byte UTF-8 prefix (bytes >= 0x80)
+///
+/// Usage:
+///   bench_sort [runs] [entries...]
+///     runs     runs per configuration; the median is reported. Default: 5
+///     entries  listing sizes. Default: 100000 1000000 5000000
+//--------------------------------------------------------------------------------------------------
+
+#include "dirtree.h"
+#include <time.h>
+
+#define MAX_RUNS 101          ///< maximum number of runs per configuration
+
+/// @brief name generator: writes the name of entry @a i to @a buf and returns its length
+typedef size_t (*namegen)(char *buf, size_t i, uint64_t *rng);
+
+/// @brief xorshift64 pseudo random number generator
+static uint64_t rnd(uint64_t *s)
+{
+  *s ^= *s << 13;
+  *s ^= *s >> 7;
+  *s ^= *s << 17;
+  return *s;
+}
+
+static size_t gen_numbered(char *buf, size_t i, uint64_t *rng)
+{
+  return (size_t)sprintf(buf, "file_%zu", i);
+}
+
+static size_t gen_prefix(char *buf, size_t i, uint64_t *rng)
+{
+  return (size_t)sprintf(buf, "IMG_20240101_%07zu.jpg", i);
+}
+
+static size_t gen_random(char *buf, size_t i, uint64_t *rng)
+{
+  size_t len = 1 + rnd(rng) % 12;
+  for (size_t k = 0; k < len; k++) {
+    // any byte but '\0' and '/'
+    unsigned char c;
+    do c = (unsigned char)(1 + rnd(rng) % 255); while (c == '/');
+    buf[k] = (char)c;
+  }
+  return len;
+}
+
+static size_t gen_utf8(char *buf, size_t i, uint64_t *rng)
+{
+  return (size_t)sprintf(buf, "\xec\x82\xac\xec\xa7\x84_%zu", i);
+}
+
+static const struct {
+  const char *name;
+  namegen gen;
+} sets[] = {
+  { "numbered", gen_numbered },
+  { "prefix",   gen_prefix },
+  { "random",   gen_random },
+  { "utf8",     gen_utf8 },
+};
+
+/// @brief the comparator of the replaced qsort_r() path: directories first, then by name
+static int old_compare(const void *a, const void *b, void *names)
+{
+  const struct entry *e1 = (const struct entry*)a;
+  const struct entry *e2 = (const struct entry*)b;
+
+  if (e1->type != e2->type) {
+    if (e1->type == DT_DIR) return -1;
+    if (e2->type == DT_DIR) return 1;
+  }
+  return strcmp((char*)names + e1->name, (char*)names + e2->name);
+}
+
+static double now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/// @brief build listing @a l with @a n names of name set @a gen in shuffled order
+static void build(struct listing *l, size_t n, namegen gen)
+{
+  uint64_t rng = 0x9e3779b97f4a7c15ULL;
+  size_t *perm = (size_t*)xmalloc(n * sizeof(size_t));
+  char buf[64];
+
+  for (size_t i = 0; i < n; i++) perm[i] = i;
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t j = rnd(&rng) % (i + 1);
+    size_t t = perm[i];
+    perm[i] = perm[j];
+    perm[j] = t;
+  }
+
+  memset(l, 0, sizeof(*l));
+  for (size_t i = 0; i < n; i++) {
+    size_t len = gen(buf, perm[i], &rng);
+    listing_push(l, i, (perm[i] % 10 == 0) ? DT_DIR : DT_REG, buf, len);
+  }
+  free(perm);
+}
+
+/// @brief true if @a a and @a b hold the same names and types in the same order
+static bool same_order(const struct entry *a, const struct entry *b, size_t n, const char *names)
+{
+  for (size_t i = 0; i < n; i++) {
+    if ((a[i].type != b[i].type) || strcmp(names + a[i].name, names + b[i].name)) return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  static const size_t defsizes[] = { 100000, 1000000, 5000000 };
+  static const char *algos[] = { "qsort_r", "compare", "radix", "auto" };
+  static const unsigned int algo_ids[] = { 0, SORT_COMPARE, SORT_RADIX, SORT_AUTO };
+
+  int runs = (argc > 1) ? atoi(argv[1]) : 5;
+  if ((runs < 1) || (runs > MAX_RUNS)) {
+    fprintf(stderr, "Usage: %s [runs] [entries...]   (1 <= runs <= %d)\n", argv[0], MAX_RUNS);
+    return EXIT_FAILURE;
+  }
+  size_t nsizes = (argc > 2) ? (size_t)(argc - 2) : sizeof(defsizes)/sizeof(defsizes[0]);
+
+  printf("%-9s %9s %-8s %12s %8s\n", "names", "entries", "sort", "median [ms]", "speedup");
+  bool ok = true;
+
+  for (size_t s = 0; s < nsizes; s++) {
+    size_t n = (argc > 2) ? (size_t)strtoull(argv[s + 2], NULL, 10) : defsizes[s];
+    if (n < 2) continue;
+
+    for (size_t set = 0; set < sizeof(sets)/sizeof(sets[0]); set++) {
+      struct arena_mark ent_mark = arena_mark(&ent_arena);
+      struct arena_mark str_mark = arena_mark(&str_arena);
+      struct listing master;
+      build(&master, n, sets[set].gen);
+
+      struct entry *ref = (struct entry*)xmalloc(n * sizeof(struct entry));
+      struct entry *work = (struct entry*)xmalloc(n * sizeof(struct entry));
+      double base = 0;
+
+      for (size_t a = 0; a < sizeof(algos)/sizeof(algos[0]); a++) {
+        double t[MAX_RUNS];
+
+        for (int r = 0; r < runs; r++) {
+          memcpy(work, master.ents, n * sizeof(struct entry));
+          struct listing l = master;
+          l.ents = work;
+
+          double start = now_ms();
+          if (a == 0) qsort_r(work, n, sizeof(struct entry), old_compare, master.names);
+          else {
+            sort_algo = algo_ids[a];
+            listing_sort(&l);
+          }
+          t[r] = now_ms() - start;
+        }
+
+        if (a == 0) memcpy(ref, work, n * sizeof(struct entry));
+        else if (!same_order(ref, work, n, master.names)) {
+          fprintf(stderr, "%s, %zu entries: --sort-algo=%s differs from qsort_r()\n",
+                  sets[set].name, n, algos[a]);
+          ok = false;
+        }
+
+        qsort(t, runs, sizeof(double), cmp_double);
+        double med = (runs % 2) ? t[runs/2] : (t[runs/2 - 1] + t[runs/2]) / 2;
+        if (a == 0) base = med;
+        printf("%-9s %9zu %-8s %12.2f %7.2fx\n", sets[set].name, n, algos[a], med, base / med);
+        fflush(stdout);
+      }
+
+      free(work);
+      free(ref);
+      arena_release(&str_arena, str_mark);
+      arena_release(&ent_arena, ent_mark);
+    }
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,98 @@
+#!/bin/bash
+#---------------------------------------------------------------------------------------------------
+# System Programming                         I/O Lab                                    Fall 2024
+#
+# script to generate large directory trees for benchmarking
+#
+# Usage:
+#   genbench.sh deep <dir> [depth] [fanout] [files]
+#     a balanced tree <depth> levels deep; every directory holds <files> files and (except
+#     for the last level) <fanout> subdirectories. Default: 12 levels, 2 subdirs, 8 files.
+#   genbench.sh flat <dir> [entries]
+#     a single directory holding <entries> empty files. Default: 1000000 entries.
+#   genbench.sh chain <dir> [depth] [siblings]
+#     a single chain of <depth> nested directories. Default: 10000 levels. With siblings=1,
+#     every level also holds an empty directory next to the chain. Default: 0.
+#
+# Then time the traversal, e.g.
+#   /usr/bin/time -v bin/dirtree -s bench > /dev/null
+#
+
+MODE=$1
+DIR=$2
+
+if [[ -z "$MODE" || -z "$DIR" ]]; then
+  echo "Usage: $0 deep|flat|chain <dir> [parameters...]"
+  exit 1
+fi
+
+if [[ -e "$DIR" ]]; then
+  echo "'$DIR' already exists."
+  exit 1
+fi
+
+case $MODE in
+  deep) # balanced tree: every directory has FANOUT subdirectories and FILES files
+    DEPTH=${3:-12}
+    FANOUT=${4:-2}
+    NFILES=${5:-8}
+
+    echo "Generating deep tree in '$DIR' (depth $DEPTH, fanout $FANOUT, $NFILES files per dir)..."
+    # breadth-first: the list of directories of the current level
+    level=("$DIR")
+    mkdir -p "$DIR" || exit 1
+    for ((d=0; d<DEPTH; d++)); do
+      next=()
+      for p in "${level[@]}"; do
+        for ((f=0; f<NFILES; f++)); do : > "$p/file_$f"; done
+        if ((d < DEPTH-1)); then
+          for ((s=0; s<FANOUT; s++)); do next+=("$p/sub_$s"); done
+        fi
+      done
+      ((${#next[@]} > 0)) && mkdir "${next[@]}"
+      level=("${next[@]}")
+    done
+    ;;
+
+  flat) # one huge directory
+    N=${3:-1000000}
+
+    echo "Generating flat directory '$DIR' with $N entries..."
+    mkdir -p "$DIR" && cd "$DIR" || exit 1
+    # touch in batches to keep the argument list short
+    for ((i=0; i<N; i+=10000)); do
+      eval touch "entry_{$i..$((i+9999 < N-1 ? i+9999 : N-1))}"
+    done
+    ;;
+
+  chain) # one very deep chain; too deep for full path names, so descend with cd in steps of
+         # 500 levels (one level at a time is quadratic since the shell tracks the full $PWD)
+    DEPTH=${3:-10000}
+    SIBLINGS=${4:-0}
+
+    echo "Generating chain of $DEPTH directories in '$DIR'..."
+    mkdir -p "$DIR" && cd "$DIR" || exit 1
+    for ((i=0; i<DEPTH; i+=500)); do
+      n=$((DEPTH-i < 500 ? DEPTH-i : 500))
+      p=$(printf 'd/%.0s' $(seq $n))
+      mkdir -p "$p" || exit 1
+      if ((SIBLINGS)); then
+        # the sibling "s" of every level of this step: s, d/s, d/d/s, ...
+        sib=("s")
+        for ((j=1; j<n; j++)); do sib+=("${p:0:2*j}s"); done
+        mkdir "${sib[@]}" || exit 1
+      fi
+      cd "$p" || exit 1
+    done
+    : > leaf
+    ;;
+
+  *)
+    echo "Unknown mode '$MODE'."
+    exit 1
+    ;;
+esac
+
+echo "Done."
+
+exit 0
@@ -0,0 +1,78 @@
+#!/bin/bash
+#---------------------------------------------------------------------------------------------------
+# System Programming                         I/O Lab                                    Fall 2024
+#
+# regression test for very deep trees: a chain of nested directories (genbench.sh chain) must be
+# traversed completely by the sequential walk, -j and -U, with a small thread stack and with few
+# file descriptors, and all modes must print the same output. A second chain has a sibling
+# directory on every level, so -j has a pending subdirectory on every level of the chain.
+#
+# Usage:
+#   test_deep.sh [dirtree] [depth]
+#     dirtree  binary to test. Default: bin/dirtree
+#     depth    levels of the chain. Default: 10000
+#
+
+# resolved now: the binary is run from inside the test directory
+BIN=$(realpath -- "${1:-bin/dirtree}")
+DEPTH=${2:-10000}
+GENBENCH=${0%/*}/genbench.sh
+
+if [[ ! -x "$BIN" ]]; then
+  echo "Cannot execute '${1:-bin/dirtree}'."
+  exit 1
+fi
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+"$GENBENCH" chain "$TMP/chain" "$DEPTH" > /dev/null || exit 1
+"$GENBENCH" chain "$TMP/ladder" "$DEPTH" 1 > /dev/null || exit 1
+
+# run dirtree -s on $TREE with the given ulimit settings and options; check the summary against
+# $EXPECTED and compare the output with that of the first run on $TREE
+FAIL=0
+REF=
+run() {
+  local limits=$1
+  shift
+  local out=$TMP/out
+
+  (ulimit $limits && cd "$TMP" && exec "$BIN" -s "$@" "$TREE") > "$out" 2> "$TMP/err"
+  local ret=$?
+  local summary=$(tail -n 2 "$out" | head -n 1)
+  local sum=$(md5sum < "$out")
+
+  if [[ $ret -ne 0 || "$summary" != "$EXPECTED" || -s "$TMP/err" ]]; then
+    echo "FAIL: ulimit $limits; dirtree -s $*: exit code $ret, summary '$summary'"
+    head -n 3 "$TMP/err"
+    FAIL=1
+  elif [[ -n "$REF" && "$sum" != "$REF" ]]; then
+    echo "FAIL: ulimit $limits; dirtree -s $*: output differs from the sequential walk"
+    FAIL=1
+  else
+    echo "ok:   ulimit $limits; dirtree -s $*"
+  fi
+  [[ -z "$REF" ]] && REF=$sum
+}
+
+echo "Testing '$BIN' on a chain of $DEPTH directories..."
+TREE=chain
+EXPECTED="1 file, $DEPTH directories, 0 links, 0 pipes, and 0 sockets"
+run "-s 256"
+run "-s 256" -j 4
+run "-s 256" -U
+run "-s 256" -U -j 4
+run "-n 24"
+run "-n 24" -U
+run "-n 12"
+
+echo "Testing '$BIN' on a chain of $DEPTH directories with siblings..."
+TREE=ladder
+EXPECTED="1 file, $((2*DEPTH)) directories, 0 links, 0 pipes, and 0 sockets"
+REF=
+run "-n 64"
+run "-n 64" -j 1
+run "-n 64" -j 4
+
+exit $FAIL
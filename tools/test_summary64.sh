@@ -0,0 +1,109 @@
+#!/bin/bash
+#---------------------------------------------------------------------------------------------------
+# System Programming                         I/O Lab                                    Fall 2024
+#
+# regression test for the 64-bit summary counters: totals beyond 2^32 must survive merging and
+# printing.
+#   - a small driver linked against the sources merges summaries whose counters add up past
+#     2^32 with summary_merge() and prints them with print_summary() and print_totals()
+#   - dirtree -v -s, sequential and with -j, is run on two trees of sparse files whose sizes
+#     add up past 2^32 per tree and for both together
+#
+# Usage:
+#   test_summary64.sh [dirtree]
+#     dirtree  binary to test. Default: bin/dirtree
+#   The driver is compiled with $CC (default: gcc).
+#
+
+# resolved now: the binary is run from inside the test directory
+BIN=$(realpath -- "${1:-bin/dirtree}")
+CC=${CC:-gcc}
+SRC=${0%/*}/../src
+
+if [[ ! -x "$BIN" ]]; then
+  echo "Cannot execute '${1:-bin/dirtree}'."
+  exit 1
+fi
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+FAIL=0
+# check that file $1 contains line $2
+expect() {
+  if grep -qxF -- "$2" "$1"; then
+    echo "ok:   $3"
+  else
+    echo "FAIL: $3: no line '$2'"
+    FAIL=1
+  fi
+}
+
+# driver: the sources with dirtree's main() renamed
+cat > "$TMP/driver.c" << 'EOF'
+#include "dirtree.h"
+
+int main(void)
+{
+  struct summary a = { .dirs = 4294967295ULL, .files = 3000000000ULL, .links = 2147483648ULL,
+                       .fifos = 4294967296ULL, .socks = 1, .size = 1ULL << 40,
+                       .blocks = 3000000000ULL, .excluded = 2500000000ULL,
+                       .pruned = 2500000000ULL };
+  struct summary t = { 0 };
+
+  summary_merge(&t, &a);
+  summary_merge(&t, &a);
+  print_summary(&t, F_VERBOSE | F_EXCLUDE);
+  print_totals(2, &t, F_VERBOSE | F_EXCLUDE);
+  out_flush();
+  return 0;
+}
+EOF
+OBJS=()
+for f in "$SRC"/*.c; do
+  o=$TMP/$(basename "$f" .c).o
+  DEFS=
+  [[ $(basename "$f") == dirtree.c ]] && DEFS=-Dmain=dirtree_main
+  $CC -O2 -pthread -w $DEFS -c "$f" -o "$o" || exit 1
+  OBJS+=("$o")
+done
+$CC -O2 -pthread -w -I"$SRC" "$TMP/driver.c" "${OBJS[@]}" -o "$TMP/driver" || exit 1
+"$TMP/driver" > "$TMP/out"
+
+echo "Testing summary_merge() and the summary output..."
+expect "$TMP/out" "$(printf '%-68.68s   %14s %9s' \
+       "6000000000 files, 8589934590 directories, 4294967296 links, 8589934592 pipes, and 2 sockets" \
+       2199023255552 6000000000)" "print_summary()"
+expect "$TMP/out" "5000000000 entries excluded, 5000000000 directories pruned" "print_summary(): excluded/pruned"
+expect "$TMP/out" "  total # of files:              6000000000" "print_totals(): files"
+expect "$TMP/out" "  total # of directories:        8589934590" "print_totals(): directories"
+expect "$TMP/out" "  total # of pipes:              8589934592" "print_totals(): pipes"
+expect "$TMP/out" "  total # excluded:              5000000000" "print_totals(): excluded"
+expect "$TMP/out" "  total file size:            2199023255552" "print_totals(): size"
+expect "$TMP/out" "  total # of blocks:             6000000000" "print_totals(): blocks"
+
+# two trees with three sparse 1.5 GiB files each, at different depths so that the sizes go
+# through the per-directory (and with -j, per-worker) summaries
+for t in a b; do
+  mkdir -p "$TMP/$t/x/y" || exit 1
+  for f in $t/f $t/x/f $t/x/y/f; do
+    truncate -s 1536M "$TMP/$f" || exit 1
+  done
+done
+
+# the directories x and y count as well; their sizes depend on the file system
+read -r DSIZE DBLOCKS <<< $(stat -c '%s %b' "$TMP"/a/x "$TMP"/a/x/y | \
+                            awk '{ s += $1; b += $2 } END { print s, b }')
+SIZE=$((3*1536*1024*1024 + DSIZE))
+
+echo "Testing '$BIN' on sparse files..."
+for args in "" "-j 4"; do
+  (cd "$TMP" && exec "$BIN" -v -s $args a b) > "$TMP/out" 2>&1
+  expect "$TMP/out" "$(printf '%-68.68s   %14s %9s' \
+         "3 files, 2 directories, 0 links, 0 pipes, and 0 sockets" $SIZE $DBLOCKS)" \
+         "dirtree -v -s $args: summary of a tree"
+  expect "$TMP/out" "$(printf '  total file size:         %16s' $((2*SIZE)))" \
+         "dirtree -v -s $args: total size"
+done
+
+exit $FAIL